@@ -1,6 +1,10 @@
+#define _GNU_SOURCE	/* recvmmsg() */
+
 #include <netinet/in.h>
 #include <netinet/ip_icmp.h>
+#include <linux/errqueue.h>
 #include <arpa/inet.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -18,8 +22,15 @@
 #include <math.h>
 #include <signal.h>
 #include <sysexits.h>
+#include <net/if.h>
+#include <getopt.h>
 
+#include "ping.h"
+#include "ping_daemon.h"
 #include "ping_utils.h"
+#include "ping_timer.h"
+#include "ping_prof.h"
+#include "ping_dash.h"
 
 #define HELP_STRING \
     "Usage: ft_ping [OPTION...] HOST ...\n" \
@@ -27,24 +38,51 @@
     "\n" \
     "Options:\n" \
     "  -v                 verbose output\n" \
-    "  -f                 flood ping (root only)\n" \
+    "  -f                 flood ping\n" \
     "  -i <interval>      interval in seconds between ping messages [default 1s]\n" \
     "  -c <count>         number of messages to send, 0 is infinity [default 0]\n" \
     "  -p <pattern>       fill ICMP packet with given pattern (hex)\n" \
     "  -t <N>             specify N as time-to-live\n" \
+    "  -O                 report lost packets as soon as they time out\n" \
+    "  -T <tos>[,<tos>..] set type of service, a list probes each class at once\n" \
+    "  -I <iface|addr>    send from the given interface or source address\n" \
+    "  -m <mark>          tag outgoing packets with the given firewall mark\n" \
+    "  -S <size>          set socket send and receive buffer sizes\n" \
+    "      --self-stats   report where ft_ping spends its time at exit and\n" \
+    "                     on SIGUSR1\n" \
+    "      --timestamp    send ICMP_TIMESTAMP packets instead of ECHO_REQUEST\n" \
+    "      --daemon <file> ping the hosts listed in file until interrupted,\n" \
+    "                     reloading it on SIGHUP\n" \
+    "      --control <path> accept add, del, reload, list and stats commands\n" \
+    "                     on a unix socket (daemon mode)\n" \
+    "      --window <N>   flood keeping at most N requests outstanding\n" \
+    "      --ramp         flood raising the rate until loss or RTT\n" \
+    "                     inflation appear and report that knee\n" \
+    "      --dashboard    show a live table of every host instead of one\n" \
+    "                     line per reply\n" \
     "  -?                 give this help list\n"
 
-#define PING_DATALEN			(64 - sizeof(struct icmphdr))
 #define PING_DEFAULT_INTERVAL	1000.0	/* Milliseconds */
-#define PING_MS_PER_SEC			1000	/* Millisecond precision */
 #define PING_MIN_INTERVAL		0.2
-#define PING_MAX_WAIT			(10 * PING_MS_PER_SEC)
+#define PING_MIN_RTO			(1 * PING_MS_PER_SEC)	/* RFC 6298, 2.4 */
 #define PING_SEQMAP_SIZE		128
-#define PING_MAX_PATTERN		16
 #define PING_TTL_MAX_VAL		255
 #define PING_FLOOD_WAIT			10
-
-#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define PING_TOS_MAX_VAL		255
+#define PING_MAX_PROFILES		8
+#define PING_TS_DATALEN			(3 * sizeof(uint32_t))	/* orig, recv, xmit */
+#define PING_NO_RTT				UINT64_MAX	/* Reply without a round trip */
+#define PING_SEND_BATCH			16	/* Requests sent per send syscall */
+#define PING_TW_MIN_ENTRIES		16	/* Timer wheel of a compact target */
+#define PING_TW_MIN_SLOTS		16
+#define PING_BACKOFF_MAX		(1 * PING_MS_PER_SEC)	/* Longest pause on a full queue */
+#define PING_RAMP_START			100		/* Packets per second of the first step */
+#define PING_RAMP_STEP_MS		500		/* Time each rate is held */
+#define PING_RAMP_LOSS			5		/* Loss percentage marking the knee */
+#define PING_RAMP_RTT_FACTOR	2		/* RTT inflation marking the knee ... */
+#define PING_RAMP_RTT_SLACK		1.0		/* ... once above this many ms */
+#define PING_DASH_BUCKET		(1 * PING_MS_PER_SEC)	/* Shortest window bucket */
+#define PING_DASH_NAME			24		/* Width of the host column */
 
 #ifndef IP_HDRLEN_MAX
 /* According to the RFC 791, section 3.1, the header length is 4 bits that
@@ -54,48 +92,20 @@
 #define IP_HDRLEN_MAX (0xF << 2)
 #endif
 
-/* Ping options */
-#define OPT_VERBOSE		0x01
-#define OPT_PATTERN		0x02
-#define OPT_FLOOD		0x04
-#define OPT_INTERVAL	0x08
-
-typedef struct ping_pkt_s {
-    struct icmphdr hdr;
-    unsigned char data[PING_DATALEN];
-} ping_pkt;
-
-typedef struct ping_stat_s {
-    double tmin;                  /* minimum round trip time */
-    double tmax;                  /* maximum round trip time */
-    double tsum;                  /* sum of all times, for doing average */
-    double tsumsq;                /* sum of all times squared, for std. dev. */
-} ping_stat;
-
-
-typedef struct ping_s {
-    int          fd;
-    bool         is_dgram;
-    int          id;
-    host        *dest;
-    ping_pkt     pkt;
-    ping_stat	 stat;
-    uint8_t		 seq_map[PING_SEQMAP_SIZE];
-    uint8_t		 pattern[PING_MAX_PATTERN];
-    int          pattern_len;
-    size_t       interval;
-    size_t       count;
-    size_t       num_sent;
-    size_t       num_recv;
-    size_t       num_dup;
-    int          options;
-} ping;
-
-static ping *ping_init(int ident)
+/* Keys of the options without short version */
+#define KEY_SELF_STATS	256
+#define KEY_TIMESTAMP	257
+#define KEY_DAEMON		258
+#define KEY_CONTROL		259
+#define KEY_WINDOW		260
+#define KEY_RAMP		261
+#define KEY_DASHBOARD	262
+
+static ping_sock *ping_init(int ident)
 {
     int              fd;
     struct protoent *proto;
-    ping            *p   = NULL;
+    ping_sock       *p   = NULL;
     int              one = 1;
     bool is_dgram = false;
 
@@ -130,11 +140,17 @@ static ping *ping_init(int ident)
         goto close_return;
     }
 
-    p = malloc(sizeof(ping));
+    /* Ping sockets only see the ICMP errors of their requests through the
+     * error queue, raw sockets receive them as any other message */
+    if (is_dgram && setsockopt(fd, IPPROTO_IP, IP_RECVERR, &one, sizeof(one)) != 0) {
+        goto close_return;
+    }
+
+    p = malloc(sizeof(ping_sock));
     if (p == NULL) {
         goto close_return;
     }
-    memset(p, 0, sizeof(ping));
+    memset(p, 0, sizeof(ping_sock));
 
     p->fd = fd;
     p->id = ident & 0xFFFF;
@@ -147,6 +163,231 @@ close_return:
     return NULL;
 }
 
+/* Allocates a target of sock in a single block. A compact target sizes its
+ * timer wheel and sequence map to the requests it can have in flight, only
+ * a flood needs the full ones. Returns the size of the block in *size. */
+ping *ping_alloc(ping_sock *sock, bool compact, size_t *size)
+{
+    uint16_t nent = PING_TW_ENTRIES;
+    uint16_t nslot = PING_TW_SLOTS;
+    uint16_t seq_len = PING_SEQMAP_SIZE;
+    size_t len = sizeof(ping);
+    ping *p;
+    uint8_t *mem;
+
+    if (compact && !(sock->options & OPT_FLOOD)) {
+        /* Requests expire after PING_MAX_WAIT at most */
+        nent = PING_TW_MIN_ENTRIES;
+        while (nent < PING_TW_ENTRIES && nent < PING_MAX_WAIT / sock->interval + 2) {
+            nent <<= 1;
+        }
+        nslot = PING_TW_MIN_SLOTS;
+        seq_len = nent / 8;
+    }
+
+    if (sock->options & OPT_TIMESTAMP) {
+        len += sizeof(ping_ts);
+    }
+    if (sock->options & OPT_FLOOD) {
+        len += sizeof(ping_pace);
+    }
+    if (sock->options & OPT_DASHBOARD) {
+        len += sizeof(ping_win);
+    }
+    len += ping_tw_size(nent, nslot) + seq_len;
+
+    p = calloc(1, len);
+    if (p == NULL) {
+        return NULL;
+    }
+    mem = (uint8_t *)(p + 1);
+
+    if (sock->options & OPT_TIMESTAMP) {
+        p->ts = (ping_ts *)mem;
+        mem += sizeof(ping_ts);
+    }
+    if (sock->options & OPT_FLOOD) {
+        p->pace = (ping_pace *)mem;
+        mem += sizeof(ping_pace);
+    }
+    if (sock->options & OPT_DASHBOARD) {
+        p->win = (ping_win *)mem;
+        mem += sizeof(ping_win);
+    }
+    ping_tw_setup(&p->tw, mem, nent, nslot);
+    mem += ping_tw_size(nent, nslot);
+    p->seq_map = mem;
+    p->seq_len = seq_len;
+    p->sock = sock;
+
+    if (size != NULL) {
+        *size = len;
+    }
+
+    return p;
+}
+
+/* Applies the socket options of the profile, -1 is returned on error with
+ * errno set */
+static int ping_set_sockopt(ping_sock *p, ping_sockopt *o)
+{
+    struct sockaddr_in src;
+
+    if (o->ttl > 0) {
+        if (setsockopt(p->fd, IPPROTO_IP, IP_TTL, &o->ttl, sizeof(int)) < 0) {
+            return -1;
+        }
+    }
+
+    if (o->tos >= 0) {
+        if (setsockopt(p->fd, IPPROTO_IP, IP_TOS, &o->tos, sizeof(int)) < 0) {
+            return -1;
+        }
+    }
+
+    if (o->mark != 0) {
+        if (setsockopt(p->fd, SOL_SOCKET, SO_MARK, &o->mark, sizeof(int)) < 0) {
+            return -1;
+        }
+    }
+
+    if (o->bufsize > 0) {
+        if (setsockopt(p->fd, SOL_SOCKET, SO_SNDBUF, &o->bufsize, sizeof(int)) < 0 ||
+            setsockopt(p->fd, SOL_SOCKET, SO_RCVBUF, &o->bufsize, sizeof(int)) < 0) {
+            return -1;
+        }
+    }
+
+    if (o->iface != NULL) {
+        memset(&src, 0, sizeof(src));
+        src.sin_family = AF_INET;
+
+        /* A source address is bound, anything else is an interface name */
+        if (inet_pton(AF_INET, o->iface, &src.sin_addr) == 1) {
+            if (bind(p->fd, (struct sockaddr*)&src, sizeof(src)) < 0) {
+                return -1;
+            }
+        }
+        else if (setsockopt(p->fd, SOL_SOCKET, SO_BINDTODEVICE, o->iface,
+                            strnlen(o->iface, IFNAMSIZ - 1) + 1) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void ping_stat_update(ping_stat *stat, uint64_t triptime, bool dupflag)
+{
+    double ms = triptime / 1e6;
+
+    stat->tsum += triptime;
+    stat->tcount++;
+    stat->tsumsq += ms * ms;
+    if (triptime < stat->tmin) {
+        stat->tmin = triptime;
+    }
+    if (triptime > stat->tmax) {
+        stat->tmax = triptime;
+    }
+
+    /* Smoothed estimators (RFC 6298, 2.2 and 2.3). Duplicates are
+     * ambiguous samples, so they are left out (Karn's algorithm). */
+    if (!dupflag) {
+        int64_t rtt = triptime;
+
+        if (stat->tnum == 0) {
+            stat->srtt = rtt;
+            stat->rttvar = rtt / 2;
+        }
+        else {
+            int64_t err = stat->srtt - rtt;
+
+            stat->rttvar += ((err < 0 ? -err : err) - stat->rttvar) / 4;
+            stat->srtt -= err / 8;
+        }
+        stat->tnum++;
+    }
+}
+
+/* Feeds the clock filter with the four times of an exchange: orig when the
+ * request left, recv and xmit when the peer got it and answered (peer clock)
+ * and now when the reply arrived */
+static void ping_ts_update(ping_ts *ts, uint32_t orig, uint32_t recv, uint32_t xmit,
+                           uint32_t now)
+{
+    int32_t out = ms_of_day_diff(recv, orig);
+    int32_t in = ms_of_day_diff(now, xmit);
+    int32_t fwd, ret;
+    size_t i, best = 0;
+
+    /* Offset assuming a symmetric path (RFC 5905, 8) */
+    ts->rtt[ts->num % PING_TS_FILTER] = out + in;
+    ts->offset[ts->num % PING_TS_FILTER] = (out - in) / 2;
+    ts->num++;
+
+    for (i = 1; i < ts->num && i < PING_TS_FILTER; i++) {
+        if (ts->rtt[i] < ts->rtt[best]) {
+            best = i;
+        }
+    }
+    ts->clock_offset = ts->offset[best];
+
+    /* Against the filtered offset the paths are no longer forced to be
+     * symmetric, so the extra queueing of each one shows up */
+    fwd = out - ts->clock_offset;
+    ret = in + ts->clock_offset;
+
+    if (ts->num == 1 || fwd < ts->fwd_min) {
+        ts->fwd_min = fwd;
+    }
+    if (ts->num == 1 || fwd > ts->fwd_max) {
+        ts->fwd_max = fwd;
+    }
+    if (ts->num == 1 || ret < ts->ret_min) {
+        ts->ret_min = ret;
+    }
+    if (ts->num == 1 || ret > ts->ret_max) {
+        ts->ret_max = ret;
+    }
+    ts->fwd_sum += fwd;
+    ts->ret_sum += ret;
+}
+
+/* On ping sockets the kernel replaces the identifier of every request by
+ * the port the socket is bound to. Bind now (unless -I did) and learn it, so
+ * replies can be validated like in raw mode. */
+static int ping_bind_ident(ping_sock *p)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    if (!p->is_dgram) {
+        return 0;
+    }
+
+    if (getsockname(p->fd, (struct sockaddr*)&addr, &len) < 0) {
+        return -1;
+    }
+
+    if (addr.sin_port == 0) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        if (bind(p->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            return -1;
+        }
+
+        len = sizeof(addr);
+        if (getsockname(p->fd, (struct sockaddr*)&addr, &len) < 0) {
+            return -1;
+        }
+    }
+
+    p->id = ntohs(addr.sin_port);
+
+    return 0;
+}
+
 /*
  * NOTE: The inetutils-2.0 does not take into consideration if the socket is
  * DGRAM or RAW at the moment of assigning the ip header when decoding the
@@ -155,11 +396,13 @@ close_return:
  * data being random numbers. This I understand is just made as undefined
  * behavior, and I preferred to set ttl to 0 instead.
  */
-static void ping_print_echo(bool dupflag, bool flood, struct sockaddr_in *from,
-                            struct ip *ip, ping_stat *stat, ping_pkt *pkt, int len)
+static inline __attribute__((always_inline))
+uint64_t ping_print_echo(bool dupflag, bool flood, bool dash, struct sockaddr_in *from,
+                         struct ip *ip, ping_stat *stat, ping_pkt *pkt, int len,
+                         const char *label)
 {
     bool timing = false;
-    double triptime = 0.0;
+    uint64_t triptime = PING_NO_RTT;
     uint8_t ttl = 0;
 
     if (ip != NULL) {
@@ -176,22 +419,20 @@ static void ping_print_echo(bool dupflag, bool flood, struct sockaddr_in *from,
 
         /* Copy to avoid missalignement */
         memcpy(&before, pkt->data, sizeof(struct timespec));
-        triptime = timespec_to_ms(timespec_substract(now, before));
+        now = timespec_normalise(timespec_substract(now, before));
+        triptime = now.tv_sec * 1000000000ULL + now.tv_nsec;
 
-        /* Update statistics */
-        stat->tsum += triptime;
-        stat->tsumsq += triptime * triptime;
-        if (triptime < stat->tmin) {
-            stat->tmin = triptime;
-        }
-        if (triptime > stat->tmax) {
-            stat->tmax = triptime;
-        }
+        ping_stat_update(stat, triptime, dupflag);
+    }
+
+    /* The dashboard shows the replies instead */
+    if (dash) {
+        return triptime;
     }
 
     if (flood) {
         putchar('\b');
-        return;
+        return triptime;
     }
 
     printf ("%d bytes from %s: icmp_seq=%u", len,
@@ -200,7 +441,11 @@ static void ping_print_echo(bool dupflag, bool flood, struct sockaddr_in *from,
     printf (" ttl=%d", ttl);
 
     if (timing) {
-        printf (" time=%.3f ms", triptime);
+        printf (" time=%.3f ms", triptime / 1e6);
+    }
+
+    if (label[0] != '\0') {
+        printf (" %s", label);
     }
 
     if (dupflag) {
@@ -208,17 +453,103 @@ static void ping_print_echo(bool dupflag, bool flood, struct sockaddr_in *from,
     }
 
     printf ("\n");
+
+    return triptime;
+}
+
+/* Returns the round trip in nanoseconds, PING_NO_RTT if the clocks went
+ * wrong */
+static uint64_t ping_print_timestamp(ping *p, bool dupflag, struct sockaddr_in *from,
+                                     struct ip *ip, ping_pkt *pkt, int len)
+{
+    uint32_t times[3];
+    uint32_t orig, recv, xmit, now;
+    int32_t triptime;
+    uint64_t rtt;
+    uint8_t ttl = 0;
+    bool standard;
+
+    now = ms_since_midnight();
+
+    if (ip != NULL) {
+        ttl = ip->ip_ttl;
+        len  = len - (ip->ip_hl << 2);
+    }
+
+    /* Copy to avoid missalignement */
+    memcpy(times, pkt->data, sizeof(times));
+    orig = ntohl(times[0]);
+    recv = ntohl(times[1]);
+    xmit = ntohl(times[2]);
+
+    /* RFC 792: the high-order bit flags a time that is not in milliseconds
+     * since midnight UT, only the round trip can be trusted then */
+    standard = !((recv | xmit) & 0x80000000);
+
+    triptime = ms_of_day_diff(now, orig);
+    if (standard) {
+        triptime -= ms_of_day_diff(xmit, recv);
+    }
+
+    /* Negative when the clocks went wrong, not worth a sample. The clock
+     * filter would even take it for the best one. */
+    rtt = PING_NO_RTT;
+    if (triptime >= 0) {
+        rtt = triptime * 1000000ULL;
+        ping_stat_update(&p->stat, rtt, dupflag);
+        if (standard && !dupflag) {
+            ping_ts_update(p->ts, orig, recv, xmit, now);
+        }
+    }
+
+    if (p->sock->options & OPT_DASHBOARD) {
+        return rtt;
+    }
+
+    if (p->sock->options & OPT_FLOOD) {
+        putchar('\b');
+        return rtt;
+    }
+
+    printf ("%d bytes from %s: icmp_seq=%u", len,
+            inet_ntoa (*(struct in_addr*) &from->sin_addr.s_addr),
+            ntohs (pkt->hdr.un.echo.sequence));
+    printf (" ttl=%d time=%d ms", ttl, triptime);
+
+    if (p->sock->label[0] != '\0') {
+        printf (" %s", p->sock->label);
+    }
+
+    if (dupflag) {
+        printf (" (DUP!)");
+    }
+
+    printf ("\nicmp_otime = %u\nicmp_rtime = %u\nicmp_ttime = %u\n", orig, recv, xmit);
+
+    if (standard && rtt != PING_NO_RTT && p->ts->num > 0) {
+        printf ("one-way forward=%d ms return=%d ms (clock offset %d ms)\n",
+                ms_of_day_diff(recv, orig) - p->ts->clock_offset,
+                ms_of_day_diff(now, xmit) + p->ts->clock_offset,
+                p->ts->clock_offset);
+    }
+
+    return rtt;
 }
 
-static void ping_print_stat(ping *p)
+void ping_print_stat(ping *p)
 {
     fflush (stdout);
-    printf ("--- %s ping statistics ---\n", p->dest->name);
-    printf ("%zu packets transmitted, ", p->num_sent);
-    printf ("%zu packets received, ", p->num_recv);
+    if (p->sock->label[0] != '\0') {
+        printf ("--- %s ping statistics (%s) ---\n", p->dest.name, p->sock->label);
+    }
+    else {
+        printf ("--- %s ping statistics ---\n", p->dest.name);
+    }
+    printf ("%" PRIu32 " packets transmitted, ", p->num_sent);
+    printf ("%" PRIu32 " packets received, ", p->num_recv);
 
     if (p->num_dup != 0) {
-        printf ("+%zu duplicates, ", p->num_dup);
+        printf ("+%" PRIu32 " duplicates, ", p->num_dup);
     }
     if (p->num_sent != 0) {
         if (p->num_recv > p->num_sent) {
@@ -231,40 +562,165 @@ static void ping_print_stat(ping *p)
     }
     printf ("\n");
 
-    if (p->num_recv && ARRAY_SIZE(p->pkt.data) >= sizeof(struct timespec)) {
-        double total = p->num_recv + p->num_dup;
-        double avg = p->stat.tsum / total;
+    /* Only the replies giving a round trip count, a short echo reply or a
+     * timestamp from a wrong clock does not */
+    if (p->stat.tcount > 0) {
+        double total = p->stat.tcount;
+        double avg = p->stat.tsum / total / 1e6;
         double vari = p->stat.tsumsq / total - avg * avg;
 
         printf ("round-trip min/avg/max/stddev = %.3f/%.3f/%.3f/%.3f ms\n",
-                p->stat.tmin, avg, p->stat.tmax, nsqrt (vari, 0.0005));
+                p->stat.tmin / 1e6, avg, p->stat.tmax / 1e6, nsqrt (vari, 0.0005));
+    }
+
+    if (p->ts != NULL && p->ts->num > 0) {
+        printf ("one-way forward min/avg/max = %d/%.3f/%d ms, "
+                "return min/avg/max = %d/%.3f/%d ms\n",
+                p->ts->fwd_min, p->ts->fwd_sum / p->ts->num, p->ts->fwd_max,
+                p->ts->ret_min, p->ts->ret_sum / p->ts->num, p->ts->ret_max);
+        printf ("clock offset = %d ms\n", p->ts->clock_offset);
+    }
+
+    if (p->pace == NULL) {
+        return;
     }
+    if (p->pace->num_backoff > 0) {
+        printf ("%zu sends deferred by a full socket queue\n", p->pace->num_backoff);
+    }
+    if (p->sock->ramp) {
+        /* Even the first step was wrong, there is no good rate to report */
+        if (p->pace->knee_reason != NULL && p->pace->good_rate == 0) {
+            printf ("no knee found, %s from %.0f packets/s "
+                    "(%d%% loss, %.3f ms avg)\n", p->pace->knee_reason,
+                    p->pace->knee_rate, p->pace->knee_loss, p->pace->knee_rtt);
+        }
+        else if (p->pace->knee_reason != NULL) {
+            printf ("knee at %.0f packets/s, %s at %.0f packets/s "
+                    "(%d%% loss, %.3f ms avg)\n", p->pace->good_rate,
+                    p->pace->knee_reason, p->pace->knee_rate, p->pace->knee_loss,
+                    p->pace->knee_rtt);
+        }
+        else {
+            printf ("no knee found up to %.0f packets/s\n", p->pace->rate);
+        }
+    }
+}
+
+
+/* Retransmission timeout of RFC 6298 (2.3), used as the deadline of each
+ * request. Until the first reply is timed the classic PING_MAX_WAIT is kept. */
+static double ping_rto(ping_stat *stat)
+{
+    double rto;
+
+    if (stat->tnum == 0) {
+        return PING_MAX_WAIT;
+    }
+
+    rto = (stat->srtt + 4 * stat->rttvar) / 1e6;
+    if (rto < PING_MIN_RTO) {
+        rto = PING_MIN_RTO;
+    }
+    if (rto > PING_MAX_WAIT) {
+        rto = PING_MAX_WAIT;
+    }
+
+    return rto;
 }
 
+void ping_timeout(uint16_t seq, void *arg)
+{
+    ping *p = arg;
+
+    PING_PROBE1(timeout, seq);
+
+    if (p->win != NULL) {
+        ping_win_lost(p->win, ping_dash_tick);
+        return;
+    }
+
+    if (p->sock->options & OPT_REPORT_TIMEOUT && !(p->sock->options & OPT_FLOOD)) {
+        printf ("%s: Request timeout for icmp_seq %u\n",
+                inet_ntoa(p->dest.addr.sin_addr), seq);
+    }
+}
 
-/* Initializes ping packet with a icmp echo message */
-static void ping_create_package(ping *p)
+/* Builds the parts of the request that do not change between packets and
+ * their checksum, so sending only has to fill the sequence and the time. In
+ * timestamp mode the request is a timestamp request (RFC 792). */
+static void ping_create_package(ping_sock *p)
 {
     ping_pkt *pkt = &p->pkt;
 
     /* Reset the package */
     memset(pkt, 0, sizeof(ping_pkt));
 
-    pkt->hdr.type = ICMP_ECHO;
     pkt->hdr.un.echo.id = htons(p->id);
-    pkt->hdr.un.echo.sequence = htons(p->num_sent);
-    ping_generate_data((p->options & OPT_PATTERN) ? p->pattern : NULL, p->pattern_len,
-                       pkt->data, ARRAY_SIZE(pkt->data));
-    /* Last since all data must be set unless checksum which must be all 0 */
-    pkt->hdr.checksum = ping_calc_icmp_checksum((uint16_t*)pkt, sizeof(ping_pkt));
+    if (p->options & OPT_TIMESTAMP) {
+        /* Receive and transmit times are left to 0 for the peer to fill */
+        pkt->hdr.type = ICMP_TIMESTAMP;
+        p->pkt_len = sizeof(struct icmphdr) + PING_TS_DATALEN;
+    }
+    else {
+        pkt->hdr.type = ICMP_ECHO;
+        ping_generate_data((p->options & OPT_PATTERN) ? p->pattern : NULL, p->pattern_len,
+                           pkt->data, ARRAY_SIZE(pkt->data));
+        /* The time is filled on each send */
+        memset(pkt->data, 0, sizeof(struct timespec));
+        p->pkt_len = sizeof(ping_pkt);
+    }
+
+    /* Sequence, time and checksum are 0, so they do not add to the sum */
+    p->pkt_sum = ping_csum_partial(pkt, p->pkt_len, 0);
+}
+
+/* Completes a copy of the echo request template with the sequence and send
+ * time */
+static void ping_fill_echo(ping_sock *sock, ping_pkt *pkt, uint16_t seq)
+{
+    struct timespec now;
+    uint32_t sum;
+    uint64_t start;
+
+    pkt->hdr.un.echo.sequence = htons(seq);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    memcpy(pkt->data, &now, sizeof(struct timespec));
+
+    start = ping_prof_now();
+    pkt->hdr.checksum = 0;
+    sum = ping_csum_partial(&pkt->hdr.un.echo.sequence, sizeof(uint16_t), sock->pkt_sum);
+    sum = ping_csum_partial(pkt->data, sizeof(struct timespec), sum);
+    pkt->hdr.checksum = ping_csum_fold(sum);
+    ping_prof_add(PING_PROF_CHECKSUM, start);
+}
+
+/* Completes a copy of the timestamp request template with the sequence and
+ * the originate time */
+static void ping_fill_timestamp(ping_sock *sock, ping_pkt *pkt, uint16_t seq)
+{
+    uint32_t orig = htonl(ms_since_midnight());
+    uint32_t sum;
+    uint64_t start;
+
+    pkt->hdr.un.echo.sequence = htons(seq);
+    memcpy(pkt->data, &orig, sizeof(orig));
+
+    start = ping_prof_now();
+    pkt->hdr.checksum = 0;
+    sum = ping_csum_partial(&pkt->hdr.un.echo.sequence, sizeof(uint16_t), sock->pkt_sum);
+    sum = ping_csum_partial(pkt->data, sizeof(orig), sum);
+    pkt->hdr.checksum = ping_csum_fold(sum);
+    ping_prof_add(PING_PROF_CHECKSUM, start);
 }
 
-static int ping_validate_icmp_pkg(ping *p, uint8_t* data, size_t len, ping_pkt** pkt)
+static inline __attribute__((always_inline))
+int ping_validate_icmp_pkg(bool raw, uint8_t* data, size_t len, ping_pkt** pkt)
 {
     size_t hlen = 0;
     uint16_t chksum;
+    uint64_t start;
 
-    if (!p->is_dgram) {
+    if (raw) {
         /* Translate 32-bit words to 8-bit (RFC791, 3.1) */
         hlen = ((struct ip*)data)->ip_hl << 2;
     }
@@ -279,7 +735,9 @@ static int ping_validate_icmp_pkg(ping *p, uint8_t* data, size_t len, ping_pkt**
     /* Validate checksum */
     chksum = (*pkt)->hdr.checksum;
     (*pkt)->hdr.checksum = 0;
+    start = ping_prof_now();
     (*pkt)->hdr.checksum = ping_calc_icmp_checksum((uint16_t*)*pkt, len - hlen);
+    ping_prof_add(PING_PROF_CHECKSUM, start);
     if ((*pkt)->hdr.checksum != chksum) {
         return 1;
     }
@@ -287,83 +745,175 @@ static int ping_validate_icmp_pkg(ping *p, uint8_t* data, size_t len, ping_pkt**
     return 0;
 }
 
+/* Counts the errno of a failed syscall that the caller may want to retry */
+void ping_prof_errno(void)
+{
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        ping_prof_counters.eagain++;
+    }
+    else if (errno == EINTR) {
+        ping_prof_counters.eintr++;
+    }
+}
+
 static ssize_t ping_send(ping *p)
 {
-    ping_pkt *pkt = &p->pkt;
+    ping_sock *sock = p->sock;
     ssize_t bytes = 0;
+    struct timespec now;
+    uint64_t start = ping_prof_now();
 
-    seq_clr(p->num_sent, p->seq_map, ARRAY_SIZE(p->seq_map));
-    ping_create_package(p);
+    seq_clr(p->num_sent, p->seq_map, p->seq_len);
+    sock->fill(sock, &sock->pkt, p->num_sent);
 
-    bytes = sendto(p->fd, pkt, sizeof(ping_pkt), 0,
-                   (struct sockaddr*)&p->dest->addr,
+    bytes = sendto(sock->fd, &sock->pkt, sock->pkt_len, 0,
+                   (struct sockaddr*)&p->dest.addr,
                    sizeof(struct sockaddr_in));
+    ping_prof_counters.sys_send++;
     if ( bytes < 0) {
+        ping_prof_errno();
+        ping_prof_add(PING_PROF_SEND, start);
         return -1;
     }
+    ping_prof_counters.bytes_sent += bytes;
+    PING_PROBE1(send, p->num_sent);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ping_tw_arm(&p->tw, p->num_sent, now, ping_rto(&p->stat), ping_timeout, p);
 
     p->num_sent++;
 
+    ping_prof_add(PING_PROF_SEND, start);
+
     return bytes;
 }
 
-static ssize_t ping_recv(ping *p)
+/* Sends the next n requests of p, at most PING_SEND_BATCH, with a single
+ * sendmmsg(). Each one gets its own copy of the template. Returns how many
+ * were sent, -1 if none was. */
+static int ping_send_batch(ping *p, size_t n)
+{
+    ping_sock *sock = p->sock;
+    ping_pkt pkts[PING_SEND_BATCH];
+    struct iovec iov[PING_SEND_BATCH];
+    struct mmsghdr msgs[PING_SEND_BATCH];
+    struct timespec now;
+    uint64_t start = ping_prof_now();
+    size_t i;
+    int sent;
+
+    for (i = 0; i < n; i++) {
+        uint16_t seq = p->num_sent + i;
+
+        seq_clr(seq, p->seq_map, p->seq_len);
+        memcpy(&pkts[i], &sock->pkt, sock->pkt_len);
+        sock->fill(sock, &pkts[i], seq);
+
+        iov[i].iov_base = &pkts[i];
+        iov[i].iov_len = sock->pkt_len;
+        memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+        msgs[i].msg_hdr.msg_name = &p->dest.addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    sent = sendmmsg(sock->fd, msgs, n, 0);
+    ping_prof_counters.sys_send++;
+    if (sent < 0) {
+        ping_prof_errno();
+        ping_prof_add(PING_PROF_SEND, start);
+        return -1;
+    }
+
+    /* The ones after a failure are left for the next wakeup */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < (size_t)sent; i++) {
+        ping_prof_counters.bytes_sent += msgs[i].msg_len;
+        PING_PROBE1(send, p->num_sent);
+        ping_tw_arm(&p->tw, p->num_sent, now, ping_rto(&p->stat), ping_timeout, p);
+        p->num_sent++;
+    }
+
+    ping_prof_add(PING_PROF_SEND, start);
+
+    return sent;
+}
+
+/* Handles one received message. Every mode gets its own copy of this
+ * function, specialised through the constant arguments (see below). */
+static inline __attribute__((always_inline))
+ssize_t ping_recv_generic(ping *p, uint8_t *recv_buff, ssize_t bytes,
+                          struct sockaddr_in *from, const bool raw, const bool flood,
+                          const bool timestamp, const bool dash)
 {
-    ssize_t bytes = 0;
     int ret;
-    uint8_t recv_buff[IP_HDRLEN_MAX + sizeof(ping_pkt)];
-    socklen_t fromlen = sizeof(struct sockaddr_in);
-    struct sockaddr_in from;
     ping_pkt *pkt;
     uint16_t seq;
     bool dupflag = false;
     struct ip *ip = NULL;
+    uint64_t start;
+    uint64_t triptime;
 
-    bytes = recvfrom(p->fd, recv_buff, ARRAY_SIZE(recv_buff), 0,
-                     (struct sockaddr*)&from, &fromlen);
-    if (bytes <= 0) {
-        /* In case bytes == 0 peer closed connection, which should not happen */
-        return -1;
-    }
-
-    ret = ping_validate_icmp_pkg(p, recv_buff, bytes, &pkt);
+    ret = ping_validate_icmp_pkg(raw, recv_buff, bytes, &pkt);
     if (ret < 0) {
         fprintf (stderr, "packet too short (%ld bytes) from %s\n",
-                 bytes, inet_ntoa (p->dest->addr.sin_addr));
+                 bytes, inet_ntoa (p->dest.addr.sin_addr));
         goto exit_badmsg;
     }
 
     /* If checksum is wrong, just print and continue */
     if (ret != 0) {
         fprintf (stderr, "checksum mismatch from %s\n",
-                 inet_ntoa (p->dest->addr.sin_addr));
+                 inet_ntoa (p->dest.addr.sin_addr));
     }
 
     /* Validate the type of message */
-    if (pkt->hdr.type != ICMP_ECHOREPLY) {
+    if (timestamp) {
+        if (pkt->hdr.type != ICMP_TIMESTAMPREPLY ||
+            (uint8_t*)pkt + p->sock->pkt_len > recv_buff + bytes) {
+            goto exit_badmsg;
+        }
+    }
+    else if (pkt->hdr.type != ICMP_ECHOREPLY) {
         goto exit_badmsg;
     }
 
-    /* Validate identity (only raw mode) */
-    if (!p->is_dgram && (ntohs(pkt->hdr.un.echo.id) != p->id)) {
+    /* Validate identity */
+    if (ntohs(pkt->hdr.un.echo.id) != p->sock->id) {
         goto exit_badmsg;
     }
 
     /* Validate sequence number */
     seq = ntohs(pkt->hdr.un.echo.sequence);
-    if (seq_check(seq, p->seq_map, ARRAY_SIZE(p->seq_map))) {
+    if (seq_check(seq, p->seq_map, p->seq_len)) {
         p->num_dup++;
         dupflag = true;
     }
     else {
-        seq_set(seq, p->seq_map, ARRAY_SIZE(p->seq_map));
+        seq_set(seq, p->seq_map, p->seq_len);
+        ping_tw_cancel(&p->tw, seq);
         p->num_recv++;
     }
 
-    if (p->is_dgram == false) {
+    if (raw) {
         ip = (struct ip*)recv_buff;
     }
-    ping_print_echo(dupflag, p->options & OPT_FLOOD, &from, ip, &p->stat, pkt, bytes);
+    PING_PROBE2(recv, seq, dupflag);
+
+    start = ping_prof_now();
+    if (timestamp) {
+        triptime = ping_print_timestamp(p, dupflag, from, ip, pkt, bytes);
+    }
+    else {
+        triptime = ping_print_echo(dupflag, flood, dash, from, ip, &p->stat, pkt, bytes,
+                                   p->sock->label);
+    }
+    /* Only accounted here, the dashboard is drawn at its own pace */
+    if (dash && !dupflag && triptime != PING_NO_RTT) {
+        ping_win_add(p->win, ping_dash_tick, triptime);
+    }
+    ping_prof_add(PING_PROF_PRINT, start);
 
     return bytes;
 
@@ -372,138 +922,921 @@ exit_badmsg:
     return -1;
 }
 
-volatile bool done = false;
+#define PING_RECV_HANDLER(name, raw, flood, timestamp, dash) \
+    static ssize_t name(ping *p, uint8_t *recv_buff, ssize_t bytes, \
+                        struct sockaddr_in *from) \
+    { \
+        return ping_recv_generic(p, recv_buff, bytes, from, raw, flood, timestamp, \
+                                 dash); \
+    }
 
-static void ping_sigint_handler(int signal)
+PING_RECV_HANDLER(ping_recv_raw, true, false, false, false)
+PING_RECV_HANDLER(ping_recv_raw_flood, true, true, false, false)
+PING_RECV_HANDLER(ping_recv_dgram, false, false, false, false)
+PING_RECV_HANDLER(ping_recv_dgram_flood, false, true, false, false)
+/* Timestamps need a raw socket and flood is checked when printing */
+PING_RECV_HANDLER(ping_recv_timestamp, true, false, true, false)
+/* The dashboard prints nothing per reply, flood or not */
+PING_RECV_HANDLER(ping_recv_raw_dash, true, false, false, true)
+PING_RECV_HANDLER(ping_recv_dgram_dash, false, false, false, true)
+PING_RECV_HANDLER(ping_recv_timestamp_dash, true, false, true, true)
+
+static void ping_select_handlers(ping_sock *p)
 {
-    done = true;
+    bool flood = p->options & OPT_FLOOD;
+    bool dash = p->options & OPT_DASHBOARD;
+
+    if (p->options & OPT_TIMESTAMP) {
+        p->fill = ping_fill_timestamp;
+        p->recv_one = dash ? ping_recv_timestamp_dash : ping_recv_timestamp;
+    }
+    else if (p->is_dgram) {
+        p->fill = ping_fill_echo;
+        p->recv_one = dash ? ping_recv_dgram_dash :
+            flood ? ping_recv_dgram_flood : ping_recv_dgram;
+    }
+    else {
+        p->fill = ping_fill_echo;
+        p->recv_one = dash ? ping_recv_raw_dash :
+            flood ? ping_recv_raw_flood : ping_recv_raw;
+    }
 }
 
-/* This function return will be the exit status of the program itself so error state == 1 */
-static int ping_run(ping * p, char* host)
+/* Resolves request seq of p with the ICMP error that came back for it, len
+ * being the size of the error. It is printed as inetutils does, which
+ * shows it even when flooding. */
+static void ping_icmp_error(ping *p, uint16_t seq, size_t len, struct in_addr from,
+                            int type, int code, struct in_addr gw)
 {
-    int ret = 0;
-    ssize_t bytes;
-    size_t nresp = 0;
-    int wait;
-    bool finishing;
-    struct pollfd pfd;
-
-    /* Reset statistics */
-    memset (&p->stat, 0, sizeof (ping_stat));
-    p->stat.tmin = 999999999.0;
-    p->num_sent = 0;
-    p->num_recv = 0;
-    p->num_dup = 0;
-
-    /* Reset the sequence number map */
-    memset(p->seq_map, 0, PING_SEQMAP_SIZE);
+    bool outstanding = ping_tw_cancel(&p->tw, seq);
 
-    /* Get the new host */
-    p->dest = ping_get_host(host);
-    if (p->dest == NULL) {
-        return 1;
+    if (p->win != NULL) {
+        if (outstanding) {
+            ping_win_lost(p->win, ping_dash_tick);
+        }
+        return;
     }
 
-    pfd.fd = p->fd;
-    pfd.events = POLLIN;
+    printf ("%zu bytes from %s: ", len, ping_addr_str(from));
+    icmp_error_print(type, code, gw);
+}
 
-    /* Print the ping data */
-    printf ("PING %s (%s): %zu data bytes", p->dest->name,
-            inet_ntoa(p->dest->addr.sin_addr), ARRAY_SIZE(p->pkt.data));
-    if (p->options & OPT_VERBOSE) {
-        printf(", id 0x%04x = %u", p->id, p->id);
+/* Returns the request quoted by the ICMP error a raw socket received in buff
+ * if it is one of sock, with its destination in dest. NULL for anything
+ * else. */
+static struct icmphdr *ping_quoted_request(ping_sock *sock, uint8_t *buff, size_t len,
+                                           struct sockaddr_in *dest)
+{
+    size_t hlen = ((struct ip *)buff)->ip_hl << 2;
+    struct icmp *icmp = (struct icmp *)(buff + hlen);
+    struct ip *orig = &icmp->icmp_ip;
+    struct icmphdr *req;
+
+    if (len < hlen + ICMP_MINLEN + sizeof(struct ip)) {
+        return NULL;
+    }
+    if (icmp->icmp_type != ICMP_DEST_UNREACH && icmp->icmp_type != ICMP_SOURCE_QUENCH &&
+        icmp->icmp_type != ICMP_REDIRECT && icmp->icmp_type != ICMP_TIME_EXCEEDED &&
+        icmp->icmp_type != ICMP_PARAMETERPROB) {
+        return NULL;
     }
-    printf ("\n");
 
-    if (ping_send(p) < 0) {
-        ret = 1;
-        goto exit_clean;
+    req = (struct icmphdr *)((uint8_t *)orig + (orig->ip_hl << 2));
+    if ((uint8_t *)(req + 1) > buff + len || orig->ip_p != IPPROTO_ICMP ||
+        req->type != sock->pkt.hdr.type || ntohs(req->un.echo.id) != sock->id) {
+        return NULL;
     }
 
-    signal(SIGINT, ping_sigint_handler);
+    memset(dest, 0, sizeof(struct sockaddr_in));
+    dest->sin_family = AF_INET;
+    dest->sin_addr = orig->ip_dst;
 
-    finishing = false;
+    return req;
+}
 
-    if (p->options & OPT_FLOOD) {
-        wait = PING_FLOOD_WAIT;
+/* Reads up to max messages of sock with a single syscall and hands each of
+ * them to the target demux chooses or, without demux, to the target arg.
+ * The ICMP errors a raw socket gets go to the target of the request they
+ * quote. Returns how many of them were valid replies or -1 on error */
+ssize_t ping_recv(ping_sock *sock, size_t max, ping_demux_fn demux, void *arg)
+{
+    uint8_t recv_buff[PING_RECV_BATCH][IP_HDRLEN_MAX + sizeof(ping_pkt)];
+    struct sockaddr_in from[PING_RECV_BATCH];
+    struct iovec iov[PING_RECV_BATCH];
+    struct mmsghdr msgs[PING_RECV_BATCH];
+    ssize_t valid = 0;
+    size_t i;
+    int n;
+
+    if (max == 0 || max > PING_RECV_BATCH) {
+        max = PING_RECV_BATCH;
     }
-    else {
-        wait = p->interval;
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * max);
+    for (i = 0; i < max; i++) {
+        iov[i].iov_base = recv_buff[i];
+        iov[i].iov_len = sizeof(recv_buff[i]);
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
     }
 
-    while (!done) {
-        uint16_t chksum;
-        int pret;
+    /* poll() told there is at least one, take whatever else is queued */
+    n = recvmmsg(sock->fd, msgs, max, MSG_DONTWAIT, NULL);
+    ping_prof_counters.sys_recv++;
+    if (n <= 0) {
+        /* In case n == 0 peer closed connection, which should not happen */
+        if (n < 0) {
+            ping_prof_errno();
+        }
+        return -1;
+    }
 
-        pret = poll(&pfd, 1, wait);
-        if (pret < 0) {
-            if (errno != EINTR) {
-                ret = 1;
+    for (i = 0; i < (size_t)n; i++) {
+        struct sockaddr_in *key = &from[i];
+        struct sockaddr_in quoted;
+        struct icmphdr *req = NULL;
+        ping *dst;
+
+        ping_prof_counters.bytes_recv += msgs[i].msg_len;
+
+        /* Ping sockets get their errors through the error queue */
+        if (!sock->is_dgram) {
+            req = ping_quoted_request(sock, recv_buff[i], msgs[i].msg_len, &quoted);
+            if (req != NULL) {
+                key = &quoted;
+            }
+        }
+
+        dst = (demux != NULL) ? demux(arg, key) : arg;
+        if (dst == NULL) {
+            continue;
+        }
+
+        if (req != NULL) {
+            size_t hlen = ((struct ip *)recv_buff[i])->ip_hl << 2;
+            struct icmp *icmp = (struct icmp *)(recv_buff[i] + hlen);
+
+            if (quoted.sin_addr.s_addr == dst->dest.addr.sin_addr.s_addr) {
+                ping_icmp_error(dst, ntohs(req->un.echo.sequence), msgs[i].msg_len - hlen,
+                                from[i].sin_addr, icmp->icmp_type, icmp->icmp_code,
+                                icmp->icmp_gwaddr);
+            }
+        }
+        else if (sock->recv_one(dst, recv_buff[i], msgs[i].msg_len, &from[i]) >= 0) {
+            valid++;
+        }
+    }
+
+    return valid;
+}
+
+/* Drains the error queue of a ping socket (IP_RECVERR). Each error carries
+ * the request that caused it, which is resolved without waiting its timeout.
+ * Errors go to the target demux chooses or, without demux, to arg. */
+void ping_recv_errors(ping_sock *sock, ping_demux_fn demux, void *arg)
+{
+    uint8_t buff[sizeof(ping_pkt)];
+    uint8_t control[256];
+    struct sockaddr_in dest;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t bytes;
+    ping *p;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = buff;
+        iov.iov_len = sizeof(buff);
+        msg.msg_name = &dest;
+        msg.msg_namelen = sizeof(dest);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        bytes = recvmsg(sock->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        ping_prof_counters.sys_recv++;
+        if (bytes < 0) {
+            return;
+        }
+
+        p = (demux != NULL) ? demux(arg, &dest) : arg;
+        if (p == NULL) {
+            continue;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err *ee;
+            struct sockaddr_in *offender;
+            struct in_addr gw;
+
+            if (cmsg->cmsg_level != IPPROTO_IP || cmsg->cmsg_type != IP_RECVERR) {
+                continue;
             }
+
+            ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (ee->ee_origin != SO_EE_ORIGIN_ICMP ||
+                bytes < (ssize_t)sizeof(struct icmphdr)) {
+                continue;
+            }
+
+            /* The payload is the request as it was quoted, the error had
+             * its header and the one of the request in front of it. Only a
+             * parameter problem uses the info, as the pointer to the byte
+             * in error which inetutils prints as an address. */
+            offender = (struct sockaddr_in *)SO_EE_OFFENDER(ee);
+            gw.s_addr = htonl(ee->ee_info << 24);
+            ping_icmp_error(p, ntohs(((struct icmphdr *)buff)->un.echo.sequence),
+                            ICMP_MINLEN + sizeof(struct ip) + bytes, offender->sin_addr,
+                            ee->ee_type, ee->ee_code, gw);
+        }
+    }
+}
+
+volatile bool done = false;
+volatile sig_atomic_t self_stats = false;
+
+void ping_sigint_handler(int signal)
+{
+    done = true;
+}
+
+void ping_sigusr1_handler(int signal)
+{
+    self_stats = true;
+}
+
+/* Milliseconds from now until ts, rounded up so poll() does not wake early */
+static int ping_ms_until(struct timespec ts, struct timespec now)
+{
+    struct timespec left = timespec_normalise(timespec_substract(ts, now));
+
+    return left.tv_sec * PING_MS_PER_SEC + (left.tv_nsec + 999999) / 1000000;
+}
+
+/* Clears the state of a previous run */
+static void ping_pace_reset(ping_pace *pace)
+{
+    memset(pace, 0, sizeof(ping_pace));
+    pace->rate = PING_RAMP_START;
+}
+
+/* Judges the step whose replies are all in. The first one showing loss,
+ * RTT inflation or unable to reach its rate marks the knee and the ramp
+ * stays at the last rate judged fine. */
+static void ping_pace_judge(ping *p)
+{
+    ping_pace *pace = p->pace;
+    size_t recv = p->num_recv - pace->recv_mark;
+    double rtt = recv ? (p->stat.tsum - pace->tsum_mark) / 1e6 / recv : 0;
+    int loss = 0;
+    const char *reason = NULL;
+
+    pace->pending = false;
+    pace->recv_mark = p->num_recv;
+    pace->tsum_mark = p->stat.tsum;
+
+    if (pace->eval_sent > recv) {
+        loss = ((pace->eval_sent - recv) * 100) / pace->eval_sent;
+    }
+
+    if (loss > PING_RAMP_LOSS) {
+        reason = "loss";
+    }
+    else if (pace->base_rtt > 0 && rtt > PING_RAMP_RTT_FACTOR * pace->base_rtt &&
+             rtt - pace->base_rtt > PING_RAMP_RTT_SLACK) {
+        reason = "rtt inflation";
+    }
+    else if (pace->eval_backoff > 0) {
+        reason = "full socket queue";
+    }
+    else if (pace->eval_sent * PING_MS_PER_SEC * 10 <
+             pace->eval_rate * PING_RAMP_STEP_MS * 9) {
+        /* Less than 90% of the rate, the window or the sender limit it */
+        reason = "send rate";
+    }
+
+    if (reason == NULL) {
+        if (recv > 0 && (pace->base_rtt == 0 || rtt < pace->base_rtt)) {
+            pace->base_rtt = rtt;
+        }
+        pace->good_rate = pace->eval_rate;
+        return;
+    }
+
+    pace->knee_reason = reason;
+    pace->knee_rate = pace->eval_rate;
+    pace->knee_loss = loss;
+    pace->knee_rtt = rtt;
+    if (pace->good_rate > 0) {
+        pace->rate = pace->good_rate;
+    }
+}
+
+/* Moves the ramp along: closes the current step when its time is over and
+ * judges the previous one once its replies had a round trip to arrive */
+static void ping_pace_ramp(ping *p, struct timespec now)
+{
+    ping_pace *pace = p->pace;
+
+    if (pace->pending && ping_ms_until(pace->eval, now) == 0) {
+        ping_pace_judge(p);
+    }
+
+    if (pace->knee_reason != NULL || ping_ms_until(pace->step_end, now) > 0) {
+        return;
+    }
+
+    /* Still waiting for the replies of the previous step */
+    if (pace->pending) {
+        return;
+    }
+
+    if (pace->step_end.tv_sec != 0) {
+        int delay = p->stat.tnum ? p->stat.srtt / 1000000 + 1 : PING_RAMP_STEP_MS / 2;
+
+        if (delay > PING_RAMP_STEP_MS / 2) {
+            delay = PING_RAMP_STEP_MS / 2;
+        }
+
+        pace->pending = true;
+        pace->eval = timespec_normalise(timespec_add(now, ms_to_timespec(delay)));
+        pace->eval_rate = pace->rate;
+        pace->eval_sent = p->num_sent - pace->sent_mark;
+        pace->eval_backoff = pace->num_backoff - pace->backoff_mark;
+        pace->rate += pace->rate / 4;
+    }
+
+    pace->sent_mark = p->num_sent;
+    pace->backoff_mark = pace->num_backoff;
+    pace->step_end = timespec_normalise(timespec_add(now,
+                                                     ms_to_timespec(PING_RAMP_STEP_MS)));
+}
+
+/* Whether the window leaves room for another request */
+static inline bool ping_pace_open(ping *p)
+{
+    return p->sock->window == 0 || p->tw.active < p->sock->window;
+}
+
+/* Resets the state of p for a run against dest, the first request is due
+ * after interval */
+void ping_reset(ping *p, host *dest, int interval)
+{
+    struct timespec now;
+
+    /* Reset statistics */
+    memset (&p->stat, 0, sizeof (ping_stat));
+    if (p->ts != NULL) {
+        memset (p->ts, 0, sizeof (ping_ts));
+    }
+    if (p->pace != NULL) {
+        ping_pace_reset(p->pace);
+    }
+    if (p->win != NULL) {
+        memset (p->win, 0, sizeof (ping_win));
+    }
+    p->stat.tmin = UINT64_MAX;
+    p->num_sent = 0;
+    p->num_recv = 0;
+    p->num_dup = 0;
+    p->nresp = 0;
+    p->dest = *dest;
+    p->running = false;
+
+    /* Reset the sequence number map */
+    memset(p->seq_map, 0, p->seq_len);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ping_tw_init(&p->tw, now);
+    p->next_send = timespec_normalise(timespec_add(now, ms_to_timespec(interval)));
+}
+
+/* Resets the state of p and sends the first request to dest */
+static int ping_start(ping *p, host *dest, int interval)
+{
+    ping_reset(p, dest, interval);
+
+    if (ping_send(p) < 0) {
+        return -1;
+    }
+    p->running = true;
+
+    return 0;
+}
+
+/* Expires the due requests of p and returns how long it can wait for
+ * something to happen, -1 meaning forever. Once everything is sent p stops
+ * running as soon as every request is either answered or expired. */
+int ping_next_wait(ping *p, struct timespec now)
+{
+    bool sending;
+    int wait;
+
+    ping_tw_expire(&p->tw, now, ping_timeout, p);
+
+    sending = (p->sock->count == 0 || p->num_sent < p->sock->count);
+    if (!sending && p->tw.active == 0) {
+        p->running = false;
+        return -1;
+    }
+
+    wait = ping_tw_next(&p->tw, now);
+    if (sending && ping_pace_open(p)) {
+        int send_wait = ping_ms_until(p->next_send, now);
+
+        if (wait < 0 || send_wait < wait) {
+            wait = send_wait;
+        }
+    }
+
+    return wait;
+}
+
+/* Sends the next n requests of p. An ICMP error about an earlier request is
+ * reported by the next send on the socket, which fails or stops the burst
+ * there while the error queue tells which request it was about. The queue
+ * is read and what is left is sent again, as long as something goes out.
+ * Returns how many were sent, -1 if none was. */
+static int ping_send_n(ping *p, size_t n)
+{
+    ping_sock *sock = p->sock;
+    size_t done = 0;
+    bool retried = false;
+
+    for (;;) {
+        size_t left = n - done;
+        int sent = (left == 1) ? ((ping_send(p) < 0) ? -1 : 1) : ping_send_batch(p, left);
+
+        if (sent > 0) {
+            done += sent;
+            retried = false;
+        }
+        if (done == n || (sent < 0 && (retried || errno == ENOBUFS || errno == EAGAIN))) {
             break;
         }
 
-        if (pret > 0) {
-            /* Receiving wrong should not cause the loop to end. And the loop
-             * should end when we receive count messages even if they are wrong */
-            if (ping_recv(p) >= 0) {
-                nresp++;
+        retried = true;
+        if (sock->is_dgram) {
+            ping_recv_errors(sock, sock->demux, (sock->demux != NULL) ? sock->demux_arg : p);
+        }
+    }
+
+    return (done > 0) ? (int)done : -1;
+}
+
+/* Sends the requests of p that are due, returns -1 on a send error. The
+ * bursts of a paced flood go out with a single syscall. */
+static int ping_send_due(ping *p, struct timespec now, int interval)
+{
+    ping_sock *sock = p->sock;
+    size_t max = (sock->ramp || sock->window) ? PING_SEND_BATCH : 1;
+    size_t n;
+    int sent;
+
+    if (sock->ramp) {
+        ping_pace_ramp(p, now);
+    }
+
+    /* Only paced floods send more than one request at a time */
+    for (n = 0; n < max; n++) {
+        if ((sock->count != 0 && p->num_sent + n >= sock->count) ||
+            (sock->window != 0 && p->tw.active + n >= sock->window) ||
+            ping_ms_until(p->next_send, now) > 0) {
+            break;
+        }
+
+        /* Scheduled first so that a failed send is not retried at once. The
+         * ramp keeps its rate even when a wakeup comes late, while a window
+         * alone sends as soon as there is room. */
+        if (sock->ramp) {
+            struct timespec gap = ns_to_timespec(1000000000 / p->pace->rate);
+            struct timespec late = timespec_substract(now, p->next_send);
+
+            if (timespec_normalise(late).tv_sec > 0) {
+                p->next_send = now;
             }
+            p->next_send = timespec_normalise(timespec_add(p->next_send, gap));
+        }
+        else if (!sock->window) {
+            p->next_send = timespec_normalise(timespec_add(now, ms_to_timespec(interval)));
+        }
+    }
 
-            if (p->count && nresp >= p->count) {
-                break;
+    if (n == 0) {
+        return 0;
+    }
+
+    sent = ping_send_n(p, n);
+    if (sent < 0) {
+        /* A flood waits before trying again whatever the error, a window
+         * with room would otherwise retry at once. A full queue is
+         * congestion, not a failure. */
+        if (sock->options & OPT_FLOOD) {
+            ping_pace *pace = p->pace;
+            bool full = (errno == ENOBUFS || errno == EAGAIN);
+
+            pace->backoff = pace->backoff ? pace->backoff * 2 : 1;
+            if (pace->backoff > PING_BACKOFF_MAX) {
+                pace->backoff = PING_BACKOFF_MAX;
+            }
+            p->next_send = timespec_normalise(timespec_add(now,
+                                                           ms_to_timespec(pace->backoff)));
+            if (full) {
+                pace->num_backoff++;
+                return 0;
             }
+        }
+        return -1;
+    }
 
+    if (sock->options & OPT_FLOOD) {
+        p->pace->backoff = 0;
+        if (p->win == NULL) {
+            for (; sent > 0; sent--) {
+                putchar('.');
+            }
         }
-        else {
-            if (p->count == 0 || p->num_sent < p->count) {
-                if (ping_send(p) < 0) {
-                    ret = 1;
-                    break;
-                }
-                if (p->options & OPT_FLOOD) {
-                    putchar('.');
-                }
+    }
+
+    return 0;
+}
+
+/* Handles the poll() result of p, returns -1 if the run must be aborted */
+int ping_step(ping *p, short revents, struct timespec now, int interval)
+{
+    ping_sock *sock = p->sock;
+
+    if (revents & POLLERR) {
+        ping_recv_errors(sock, NULL, p);
+    }
+
+    if (revents & POLLIN) {
+        uint64_t start = ping_prof_now();
+        ssize_t nrecv;
+
+        /* Never read past the count, the rest stays queued */
+        nrecv = ping_recv(sock, sock->count ? sock->count - p->nresp : PING_RECV_BATCH,
+                          NULL, p);
+        ping_prof_add(PING_PROF_RECV, start);
+
+        /* Receiving wrong should not cause the loop to end. And the loop
+         * should end when we receive count messages even if they are wrong */
+        if (nrecv > 0) {
+            p->nresp += nrecv;
+        }
+
+        if (sock->count && p->nresp >= sock->count) {
+            p->running = false;
+            return 0;
+        }
+
+        /* Flood only sends when the line has been quiet for a while,
+         * unless it is paced by the window or the ramp or backing off */
+        if (sock->options & OPT_FLOOD && !sock->window && !sock->ramp &&
+            p->pace->backoff == 0) {
+            p->next_send = timespec_normalise(timespec_add(now, ms_to_timespec(interval)));
+        }
+    }
+
+    return ping_send_due(p, now, interval);
+}
+
+void ping_print_header(ping_sock *p, host *dest)
+{
+    if (p->options & OPT_TIMESTAMP) {
+        printf ("PING %s (%s): sending timestamp requests", dest->name,
+                inet_ntoa(dest->addr.sin_addr));
+    }
+    else {
+        printf ("PING %s (%s): %zu data bytes", dest->name,
+                inet_ntoa(dest->addr.sin_addr), ARRAY_SIZE(p->pkt.data));
+    }
+    if (p->options & OPT_VERBOSE) {
+        printf(", id 0x%04x = %u", p->id, p->id);
+    }
+    printf ("\n");
+}
+
+volatile sig_atomic_t resized = false;
+
+static void ping_sigwinch_handler(int signal)
+{
+    resized = true;
+}
+
+/* Opens the dashboard on stdout, the window buckets last an interval and
+ * at least PING_DASH_BUCKET so slow probes still land in most of them */
+int ping_dash_start(ping_dash *d, int interval)
+{
+    fflush (stdout);
+    if (ping_dash_open(d, STDOUT_FILENO,
+                       (interval > PING_DASH_BUCKET) ? interval : PING_DASH_BUCKET) < 0) {
+        perror("dashboard");
+        return -1;
+    }
+    signal(SIGWINCH, ping_sigwinch_handler);
+
+    return 0;
+}
+
+void ping_dash_stop(ping_dash *d)
+{
+    signal(SIGWINCH, SIG_DFL);
+    ping_dash_close(d);
+}
+
+/* Draws the title and the column names, returns the first free row */
+int ping_dash_header(ping_dash *d, const char *title)
+{
+    ping_dash_text(d, 0, 0, "%s, last %u s", title,
+                   d->bucket_ms * PING_WIN_BUCKETS / PING_MS_PER_SEC);
+    ping_dash_text(d, 1, 0, "%-*s %8s %6s %9s %9s %9s  %s", PING_DASH_NAME, "HOST",
+                   "SENT", "LOSS", "LAST", "AVG", "P99", "RTT");
+
+    return 2;
+}
+
+/* Draws the row of p, s being the summary of its window at the current tick */
+void ping_dash_host(ping_dash *d, int row, ping *p, ping_win_sum *s)
+{
+    char name[PING_DASH_NAME + 1];
+    uint64_t p99 = ping_win_p99(p->win);
+    int col;
+
+    if (p->sock->label[0] != '\0') {
+        snprintf(name, sizeof(name), "%s %s", p->dest.name, p->sock->label);
+    }
+    else {
+        snprintf(name, sizeof(name), "%s", p->dest.name);
+    }
+
+    col = ping_dash_text(d, row, 0, "%-*s %8" PRIu32, PING_DASH_NAME, name, p->num_sent);
+    if (s->recv + s->lost > 0) {
+        col = ping_dash_text(d, row, col, " %5u%%",
+                             (unsigned)((uint64_t)s->lost * 100 / (s->recv + s->lost)));
+    }
+    else {
+        col = ping_dash_text(d, row, col, " %6s", "-");
+    }
+    if (s->recv > 0) {
+        col = ping_dash_text(d, row, col, " %9.3f %9.3f %9.3f  ", s->last / 1e6,
+                             s->avg / 1e6, p99 / 1e6);
+    }
+    else {
+        col = ping_dash_text(d, row, col, " %9s %9s %9s  ", "-", "-", "-");
+    }
+    ping_dash_spark(d, row, col, p->win);
+}
+
+/* Draws a frame with the profiles of a single host */
+static void ping_run_draw(ping_dash *d, ping **pv, size_t n, struct timespec now)
+{
+    char title[256];
+    ping_win_sum s;
+    size_t i;
+    int row;
+
+    ping_dash_begin(d, now);
+
+    snprintf(title, sizeof(title), "PING %s (%s)", pv[0]->dest.name,
+             inet_ntoa(pv[0]->dest.addr.sin_addr));
+    row = ping_dash_header(d, title);
+
+    for (i = 0; i < n; i++) {
+        ping_win_summary(pv[i]->win, ping_dash_tick, &s);
+        ping_dash_host(d, row + i, pv[i], &s);
+    }
+
+    ping_dash_flush(d);
+}
+
+/* Pings host with every profile in pv at the same time, each of them keeping
+ * its own statistics. This function return will be the exit status of the
+ * program itself so error state == 1 */
+static int ping_run(ping **pv, size_t n, char *hostname)
+{
+    int ret = 0;
+    int interval;
+    size_t i;
+    size_t nrun;
+    size_t nstart = 0;
+    struct pollfd pfd[PING_MAX_PROFILES];
+    struct timespec now;
+    host *dest;
+    ping_dash dash = { .fd = -1 };
+
+    /* Get the new host */
+    dest = ping_get_host(hostname);
+    if (dest == NULL) {
+        return 1;
+    }
+
+    /* Print the ping data */
+    ping_print_header(pv[0]->sock, dest);
+
+    if (pv[0]->sock->options & OPT_FLOOD) {
+        interval = PING_FLOOD_WAIT;
+    }
+    else {
+        interval = pv[0]->sock->interval;
+    }
+
+    for (i = 0; i < n; i++) {
+        pfd[i].fd = pv[i]->sock->fd;
+        pfd[i].events = POLLIN;
+
+        nstart++;
+        if (ping_start(pv[i], dest, interval) < 0) {
+            fprintf (stderr, "sending packet: %s\n", strerror(errno));
+            ret = 1;
+            nstart = 0;
+            goto exit_clean;
+        }
+    }
+
+    signal(SIGINT, ping_sigint_handler);
+    if (pv[0]->sock->options & OPT_SELF_STATS) {
+        signal(SIGUSR1, ping_sigusr1_handler);
+    }
+
+    if (pv[0]->sock->options & OPT_DASHBOARD && ping_dash_start(&dash, interval) < 0) {
+        ret = 1;
+        goto exit_clean;
+    }
+
+    while (!done) {
+        int wait = -1;
+        int pret;
+        uint64_t start;
+
+        if (self_stats) {
+            self_stats = false;
+            ping_prof_print(stderr);
+            dash.full = true;
+        }
+
+        /* On failure the previous size is kept */
+        if (resized && dash.fd >= 0) {
+            resized = false;
+            ping_dash_resize(&dash);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        nrun = 0;
+        for (i = 0; i < n; i++) {
+            int w;
+
+            if (!pv[i]->running) {
+                continue;
             }
-            else if (finishing) {
-                break;
+
+            w = ping_next_wait(pv[i], now);
+            if (!pv[i]->running) {
+                continue;
+            }
+
+            nrun++;
+            if (wait < 0 || (w >= 0 && w < wait)) {
+                wait = w;
             }
-            else {
-                finishing = true;
-                wait = PING_MAX_WAIT;
+        }
+
+        if (nrun == 0) {
+            break;
+        }
+
+        if (dash.fd >= 0) {
+            int w = ping_dash_wait(&dash, now);
+
+            if (wait < 0 || w < wait) {
+                wait = w;
+            }
+        }
+
+        start = ping_prof_now();
+        pret = poll(pfd, n, wait);
+        ping_prof_add(PING_PROF_POLL, start);
+        ping_prof_counters.sys_poll++;
+        if (pret < 0) {
+            ping_prof_errno();
+            /* Signals are handled at the top of the loop */
+            if (errno == EINTR) {
+                continue;
             }
+            ret = 1;
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        for (i = 0; i < n; i++) {
+            if (!pv[i]->running) {
+                continue;
+            }
+
+            /* As inetutils, a send error ends the run without statistics */
+            if (ping_step(pv[i], pfd[i].revents, now, interval) < 0) {
+                fprintf (stderr, "sending packet: %s\n", strerror(errno));
+                ret = 1;
+                nstart = 0;
+                goto exit_clean;
+            }
+
+            /* Finished profiles are ignored by poll() */
+            if (!pv[i]->running) {
+                pfd[i].fd = -1;
+            }
+        }
+
+        if (dash.fd >= 0 && ping_dash_wait(&dash, now) == 0) {
+            ping_run_draw(&dash, pv, n, now);
         }
     }
 
 exit_clean:
-    ping_print_stat(p);
+    if (dash.fd >= 0) {
+        ping_dash_stop(&dash);
+    }
 
-    free(p->dest->name);
-    free(p->dest);
+    for (i = 0; i < nstart; i++) {
+        ping_print_stat(pv[i]);
 
-    if (p->num_recv == 0) {
-        ret = 1;
+        if (pv[i]->num_recv == 0) {
+            ret = 1;
+        }
     }
 
+    free(dest->name);
+    free(dest);
+
     return ret;
 }
 
+/* Parses a comma separated list of type of service values into tos, returns
+ * the number of values or -1 on error with endptr pointing to the failure */
+static int ping_parse_tos(char *arg, int *tos, int len, char **endptr)
+{
+    int n = 0;
+
+    for (;;) {
+        unsigned long val = strtoul(arg, endptr, 0);
+
+        if (*endptr == arg || val > PING_TOS_MAX_VAL || n >= len) {
+            return -1;
+        }
+        tos[n++] = val;
+
+        if (**endptr == '\0') {
+            return n;
+        }
+        if (**endptr != ',') {
+            return -1;
+        }
+        arg = *endptr + 1;
+    }
+}
+
 int main(int argc, char** argv)
 {
     int c;
     int status = 0;
     bool verbose = false;
     bool flood = false;
+    bool report_timeout = false;
     double interval = PING_DEFAULT_INTERVAL;
     uint8_t pattern[PING_MAX_PATTERN] = {0};
     int pattern_len = 0;
-    int ttl = 0;
+    int tos[PING_MAX_PROFILES];
+    int ntos = 0;
+    ping_sockopt sockopt = { .tos = -1 };
     size_t count = 0;
-    ping *p;
+    int options = 0;
+    ping_sock *sv[PING_MAX_PROFILES] = {0};
+    ping *pv[PING_MAX_PROFILES] = {0};
+    size_t n;
+    size_t i;
     char *endptr;
-
-    while ((c = getopt(argc, argv, "vfi:c:p:t:?")) != -1) {
+    ping_daemon daemon = { 0 };
+    size_t window = 0;
+    bool ramp = false;
+    static const struct option long_options[] = {
+        { "self-stats", no_argument, NULL, KEY_SELF_STATS },
+        { "timestamp", no_argument, NULL, KEY_TIMESTAMP },
+        { "daemon", required_argument, NULL, KEY_DAEMON },
+        { "control", required_argument, NULL, KEY_CONTROL },
+        { "window", required_argument, NULL, KEY_WINDOW },
+        { "ramp", no_argument, NULL, KEY_RAMP },
+        { "dashboard", no_argument, NULL, KEY_DASHBOARD },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while ((c = getopt_long(argc, argv, "vfOi:c:p:t:T:I:m:S:?", long_options,
+                            NULL)) != -1) {
         switch (c) {
         case 'v':
             verbose = true;
@@ -513,6 +1846,10 @@ int main(int argc, char** argv)
             flood = true;
             break;
 
+        case 'O':
+            report_timeout = true;
+            break;
+
         case 'i':
             interval = strtod(optarg, &endptr);
             if (*endptr != '\0') {
@@ -543,21 +1880,94 @@ int main(int argc, char** argv)
             break;
 
         case 't':
-            ttl = strtoul(optarg, &endptr, 0);
+            sockopt.ttl = strtoul(optarg, &endptr, 0);
             if (*endptr != '\0') {
                 fprintf(stderr, "invalid value (`%s' near `%s')\n", optarg, endptr);
                 exit (EXIT_FAILURE);
             }
-            if (ttl == 0) {
+            if (sockopt.ttl == 0) {
                 fprintf (stderr, "option value too small: %s\n", optarg);
                 exit (EXIT_FAILURE);
             }
-            if (ttl > PING_TTL_MAX_VAL) {
+            if (sockopt.ttl > PING_TTL_MAX_VAL) {
                 fprintf (stderr, "option value too big: %s\n", optarg);
                 exit (EXIT_FAILURE);
             }
             break;
 
+        case 'T':
+            ntos = ping_parse_tos(optarg, tos, ARRAY_SIZE(tos), &endptr);
+            if (ntos < 0) {
+                fprintf(stderr, "invalid value (`%s' near `%s')\n", optarg, endptr);
+                exit (EXIT_FAILURE);
+            }
+            break;
+
+        case 'I':
+            sockopt.iface = optarg;
+            break;
+
+        case 'm':
+            sockopt.mark = strtoul(optarg, &endptr, 0);
+            if (*endptr != '\0') {
+                fprintf(stderr, "invalid value (`%s' near `%s')\n", optarg, endptr);
+                exit (EXIT_FAILURE);
+            }
+            break;
+
+        case 'S':
+            sockopt.bufsize = strtoul(optarg, &endptr, 0);
+            if (*endptr != '\0') {
+                fprintf(stderr, "invalid value (`%s' near `%s')\n", optarg, endptr);
+                exit (EXIT_FAILURE);
+            }
+            if (sockopt.bufsize <= 0) {
+                fprintf (stderr, "option value too small: %s\n", optarg);
+                exit (EXIT_FAILURE);
+            }
+            break;
+
+        case KEY_SELF_STATS:
+            options |= OPT_SELF_STATS;
+            break;
+
+        case KEY_TIMESTAMP:
+            options |= OPT_TIMESTAMP;
+            break;
+
+        case KEY_DAEMON:
+            daemon.path = optarg;
+            break;
+
+        case KEY_CONTROL:
+            daemon.ctl_path = optarg;
+            break;
+
+        case KEY_WINDOW:
+            window = strtoul(optarg, &endptr, 0);
+            if (*endptr != '\0') {
+                fprintf(stderr, "invalid value (`%s' near `%s')\n", optarg, endptr);
+                exit (EX_USAGE);
+            }
+            if (window == 0) {
+                fprintf (stderr, "option value too small: %s\n", optarg);
+                exit (EX_USAGE);
+            }
+            /* Outstanding requests are tracked in the timer wheel */
+            if (window > PING_TW_ENTRIES) {
+                fprintf (stderr, "option value too big: %s\n", optarg);
+                exit (EX_USAGE);
+            }
+            break;
+
+        case KEY_RAMP:
+            ramp = true;
+            break;
+
+        case KEY_DASHBOARD:
+            options |= OPT_DASHBOARD;
+            break;
+
         case '?':
             if (optopt && optopt != '?') {
                 exit (EX_USAGE);
@@ -567,63 +1977,168 @@ int main(int argc, char** argv)
         }
     }
 
-    if (optind >= argc) {
+    /* The hosts of the daemon come from its file */
+    if (optind >= argc && daemon.path == NULL) {
         fprintf(stderr, "missing host operand\n");
         fprintf(stderr, "Try '%s -?' for more information.\n", argv[0]);
         exit (EX_USAGE);
     }
 
-    /* Initialize ping structure */
-    p = ping_init(getpid());
-    if (p == NULL) {
-        perror("ping_init");
-        exit (EXIT_FAILURE);
-    }
-
-    /* Write the options into the ping structure */
+    /* Collect the options shared by every profile */
     if (verbose) {
-        p->options |= OPT_VERBOSE;
+        options |= OPT_VERBOSE;
     }
 
     if (flood) {
-        p->options |= OPT_FLOOD;
+        options |= OPT_FLOOD;
+    }
+
+    if (report_timeout) {
+        options |= OPT_REPORT_TIMEOUT;
     }
 
     if (interval != PING_DEFAULT_INTERVAL) {
-        p->options |= OPT_INTERVAL;
+        options |= OPT_INTERVAL;
     }
-    p->interval = interval;
 
     if (pattern_len > 0) {
-        p->options |= OPT_PATTERN;
+        options |= OPT_PATTERN;
+    }
+
+    /* One profile per type of service, each with its own socket and
+     * identifier so replies are not mixed between them */
+    n = (ntos > 0) ? ntos : 1;
+
+    for (i = 0; i < n; i++) {
+        ping_sock *p;
+
+        /* Initialize ping structure */
+        p = ping_init(getpid() + i);
+        if (p == NULL) {
+            perror("ping_init");
+            status = EXIT_FAILURE;
+            goto exit;
+        }
+        sv[i] = p;
+
+        /* Write the options into the ping structure */
+        p->options = options;
+        p->interval = interval;
+        p->count = count;
         memcpy(p->pattern, pattern, pattern_len);
         p->pattern_len = pattern_len;
-    }
+        p->window = window;
+        p->ramp = ramp;
 
-    if (ttl > 0) {
-        if (setsockopt(p->fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(int)) < 0) {
+        if (ntos > 0) {
+            sockopt.tos = tos[i];
+        }
+        if (ntos > 1) {
+            snprintf(p->label, sizeof(p->label), "tos=0x%02x", tos[i]);
+        }
+
+        /* Ping sockets only carry echo messages */
+        if (p->options & OPT_TIMESTAMP && p->is_dgram) {
+            status = 1;
+            fprintf(stderr, "timestamp requests need a raw socket (root only)\n");
+            goto exit;
+        }
+
+        if (ping_set_sockopt(p, &sockopt) < 0) {
             status = 1;
             fprintf(stderr, "setsockopt: %s\n", strerror(errno));
             goto exit;
         }
-    }
 
-    p->count = count;
+        if (ping_bind_ident(p) < 0) {
+            status = 1;
+            fprintf(stderr, "bind: %s\n", strerror(errno));
+            goto exit;
+        }
+
+        ping_select_handlers(p);
+        ping_create_package(p);
+    }
 
     /* Check option errors */
-    if (p->options & OPT_FLOOD && p->options & OPT_INTERVAL) {
+    if (options & OPT_FLOOD && options & OPT_INTERVAL) {
         status = 1;
         fprintf(stderr, "-f and -i incompatible options\n");
         goto exit;
     }
 
+    /* A timestamp request has a fixed payload, the pattern would be lost */
+    if (options & OPT_TIMESTAMP && options & OPT_PATTERN) {
+        status = 1;
+        fprintf(stderr, "--timestamp and -p incompatible options\n");
+        goto exit;
+    }
+
+    if ((window > 0 || ramp) && !(options & OPT_FLOOD)) {
+        status = 1;
+        fprintf(stderr, "--window and --ramp need -f\n");
+        goto exit;
+    }
+
+    if (options & OPT_DASHBOARD && !isatty(STDOUT_FILENO)) {
+        status = 1;
+        fprintf(stderr, "--dashboard needs a terminal\n");
+        goto exit;
+    }
+
+    if (daemon.ctl_path != NULL && daemon.path == NULL) {
+        status = 1;
+        fprintf(stderr, "--control needs --daemon\n");
+        goto exit;
+    }
+
+    if (daemon.path != NULL) {
+        if (count > 0) {
+            status = 1;
+            fprintf(stderr, "--daemon and -c incompatible options\n");
+            goto exit;
+        }
+        if (n > 1) {
+            status = 1;
+            fprintf(stderr, "--daemon takes a single type of service\n");
+            goto exit;
+        }
+        if (optind < argc) {
+            status = 1;
+            fprintf(stderr, "--daemon reads the hosts from %s\n", daemon.path);
+            goto exit;
+        }
+
+        daemon.sock = sv[0];
+        daemon.interval = (options & OPT_FLOOD) ? PING_FLOOD_WAIT : (int)interval;
+        status = ping_daemon_run(&daemon);
+        goto exit_stats;
+    }
+
+    for (i = 0; i < n; i++) {
+        pv[i] = ping_alloc(sv[i], false, NULL);
+        if (pv[i] == NULL) {
+            perror("ping_alloc");
+            status = EXIT_FAILURE;
+            goto exit;
+        }
+    }
+
     /* Loop through all the hosts */
     for (; optind < argc; optind++) {
-        status |= ping_run(p, argv[optind]);
+        status |= ping_run(pv, n, argv[optind]);
+    }
+
+exit_stats:
+    if (options & OPT_SELF_STATS) {
+        ping_prof_print(stderr);
     }
 
 exit:
-    close(p->fd);
-    free(p);
+    for (i = 0; i < n && sv[i] != NULL; i++) {
+        close(sv[i]->fd);
+        free(sv[i]);
+        free(pv[i]);
+    }
     return status;
 }
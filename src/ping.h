@@ -0,0 +1,188 @@
+#ifndef PING_H
+#define PING_H
+
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "ping_utils.h"
+#include "ping_timer.h"
+#include "ping_heap.h"
+#include "ping_dash.h"
+
+#define PING_DATALEN			(64 - sizeof(struct icmphdr))
+#define PING_MS_PER_SEC			1000	/* Millisecond precision */
+#define PING_MAX_WAIT			(10 * PING_MS_PER_SEC)
+#define PING_MAX_PATTERN		16
+#define PING_TS_FILTER			8	/* Samples kept by the clock filter */
+#define PING_RECV_BATCH			16	/* Messages read per receive syscall */
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Ping options */
+#define OPT_VERBOSE		0x01
+#define OPT_PATTERN		0x02
+#define OPT_FLOOD		0x04
+#define OPT_INTERVAL	0x08
+#define OPT_REPORT_TIMEOUT	0x10
+#define OPT_SELF_STATS	0x20
+#define OPT_TIMESTAMP	0x40
+#define OPT_DASHBOARD	0x80
+
+typedef struct ping_pkt_s {
+    struct icmphdr hdr;
+    unsigned char data[PING_DATALEN];
+} ping_pkt;
+
+/* Round trip times in nanoseconds. The squares are summed in milliseconds
+ * as a double, an integer sum of them in nanoseconds would overflow within
+ * hours and truncating them biases the deviation. */
+typedef struct ping_stat_s {
+    uint64_t tmin;                /* minimum round trip time */
+    uint64_t tmax;                /* maximum round trip time */
+    uint64_t tsum;                /* sum of all times, for doing average */
+    uint32_t tcount;              /* number of samples in tsum */
+    double   tsumsq;              /* sum of all times squared, for std. dev. */
+    int64_t  srtt;                /* smoothed round trip time */
+    int64_t  rttvar;              /* round trip time variation */
+    uint32_t tnum;                /* number of samples in srtt */
+} ping_stat;
+
+/* One-way delay estimation from ICMP timestamps. The clock offset is taken
+ * from the sample with the lowest round trip among the last PING_TS_FILTER,
+ * the one least disturbed by queueing (RFC 5905, 10). All in milliseconds. */
+typedef struct ping_ts_s {
+    int32_t rtt[PING_TS_FILTER];
+    int32_t offset[PING_TS_FILTER];
+    size_t  num;                  /* number of samples */
+    int32_t clock_offset;         /* remote clock minus local clock */
+    int32_t fwd_min, fwd_max;     /* forward path, here to there */
+    int32_t ret_min, ret_max;     /* return path, there to here */
+    double  fwd_sum, ret_sum;
+} ping_ts;
+
+/* Closed loop flood. At most window requests are kept outstanding, sends
+ * pause with exponential backoff while the socket queue is full and, when
+ * ramping, the rate is raised by a quarter every step until the replies of
+ * a step show loss or RTT inflation. The replies of a step are counted
+ * one round trip later than its sends, so that in-flight requests are not
+ * taken as lost. */
+typedef struct ping_pace_s {
+    int     backoff;              /* current pause in ms, 0 if none */
+    size_t  num_backoff;          /* sends deferred by a full queue */
+    double  rate;                 /* requests per second of the current step */
+    struct timespec step_end;
+    size_t  sent_mark;            /* num_sent when the current step began */
+    size_t  backoff_mark;         /* num_backoff when the current step began */
+    bool    pending;              /* the previous step is waiting its replies */
+    struct timespec eval;         /* when its replies are all in */
+    double  eval_rate;
+    size_t  eval_sent;
+    size_t  eval_backoff;
+    size_t  recv_mark;            /* num_recv when the previous step was judged */
+    uint64_t tsum_mark;
+    double  base_rtt;             /* lowest average of a step, ms */
+    double  good_rate;            /* highest rate judged fine */
+    const char *knee_reason;      /* NULL until the knee is found */
+    double  knee_rate;            /* rate of the first step judged wrong */
+    int     knee_loss;
+    double  knee_rtt;
+} ping_pace;
+
+/* Socket level options, applied to each socket after creation */
+typedef struct ping_sockopt_s {
+    int          ttl;             /* 0 keeps the system default */
+    int          tos;             /* -1 keeps the system default */
+    int          mark;            /* 0 means no mark */
+    int          bufsize;         /* 0 keeps the system default */
+    char        *iface;           /* interface name or source address */
+} ping_sockopt;
+
+typedef struct ping_s ping;
+typedef struct ping_sock_s ping_sock;
+
+/* Per mode handlers, selected once at startup so the per packet path does
+ * not branch on the options */
+typedef void (*ping_fill_fn)(ping_sock *sock, ping_pkt *pkt, uint16_t seq);
+typedef ssize_t (*ping_recv_fn)(ping *p, uint8_t *recv_buff, ssize_t bytes,
+                                struct sockaddr_in *from);
+
+/* Finds the target a message from the given address belongs to, used when
+ * several targets share a socket. NULL drops the message. */
+typedef ping *(*ping_demux_fn)(void *arg, struct sockaddr_in *addr);
+
+/* What the targets probed through one socket share: the socket, the
+ * options and the request template, filled in place on each send or
+ * copied for each request of a burst */
+struct ping_sock_s {
+    int          fd;
+    bool         is_dgram;
+    int          id;
+    int          options;
+    ping_pkt     pkt;
+    size_t       pkt_len;
+    uint32_t     pkt_sum;         /* checksum of the constant part of pkt */
+    ping_fill_fn fill;
+    ping_recv_fn recv_one;
+    ping_demux_fn demux;          /* set when targets share the socket */
+    void        *demux_arg;
+    uint8_t      pattern[PING_MAX_PATTERN];
+    int          pattern_len;
+    size_t       interval;
+    size_t       count;
+    size_t       window;          /* flood pacing, 0 means no limit */
+    bool         ramp;
+    char         label[16];       /* set when probing several profiles */
+};
+
+/* State of one target, allocated by ping_alloc() together with its timer
+ * wheel, its sequence map and, only in the modes using them, the timestamp,
+ * pacing and dashboard state. The counters are 32 bits: a flood wraps the
+ * 16 bit sequence space within seconds, but not them. */
+struct ping_s {
+    ping_sock   *sock;
+    host         dest;
+    uint32_t     num_sent;
+    uint32_t     num_recv;
+    uint32_t     num_dup;
+    uint32_t     nresp;
+    ping_stat    stat;
+    struct timespec next_send;
+    ping_tw      tw;
+    uint8_t     *seq_map;
+    uint16_t     seq_len;         /* bytes of seq_map */
+    bool         running;
+    unsigned     gen;             /* daemon reload that last listed it */
+    const char  *listed;          /* daemon name resolved to dest, NULL if dest.name */
+    ping_heap_node sched;         /* daemon wakeup */
+    ping_ts     *ts;              /* timestamp mode only */
+    ping_pace   *pace;            /* flood only */
+    ping_win    *win;             /* dashboard only */
+};
+
+extern volatile bool done;
+extern volatile sig_atomic_t self_stats;
+extern volatile sig_atomic_t resized;
+
+ping *ping_alloc(ping_sock *sock, bool compact, size_t *size);
+void ping_reset(ping *p, host *dest, int interval);
+int ping_step(ping *p, short revents, struct timespec now, int interval);
+int ping_next_wait(ping *p, struct timespec now);
+void ping_timeout(uint16_t seq, void *arg);
+ssize_t ping_recv(ping_sock *sock, size_t max, ping_demux_fn demux, void *arg);
+void ping_recv_errors(ping_sock *sock, ping_demux_fn demux, void *arg);
+void ping_print_header(ping_sock *p, host *dest);
+void ping_print_stat(ping *p);
+void ping_prof_errno(void);
+void ping_sigint_handler(int signal);
+void ping_sigusr1_handler(int signal);
+int ping_dash_start(ping_dash *d, int interval);
+void ping_dash_stop(ping_dash *d);
+int ping_dash_header(ping_dash *d, const char *title);
+void ping_dash_host(ping_dash *d, int row, ping *p, ping_win_sum *s);
+#endif
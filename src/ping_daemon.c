@@ -0,0 +1,839 @@
+#define _GNU_SOURCE	/* accept4() */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ping.h"
+#include "ping_daemon.h"
+#include "ping_prof.h"
+
+#define PING_DAEMON_SPREAD		7	/* ms between first requests of the daemon */
+#define PING_DASH_SLICE			1024	/* Hosts ranked per wakeup */
+#define PING_DASH_RANK			4		/* Frames between rankings */
+
+/* Whether the window of a is worse than the one of b: more losses first,
+ * then a higher average */
+static bool ping_dash_worse(ping_win_sum *a, ping_win_sum *b)
+{
+    uint64_t la = (uint64_t)a->lost * (b->recv + b->lost);
+    uint64_t lb = (uint64_t)b->lost * (a->recv + a->lost);
+
+    if (la != lb) {
+        return la > lb;
+    }
+
+    return a->avg > b->avg;
+}
+
+/* Inserts p into r if it is among the cap worst hosts seen so far */
+static void ping_rank_insert(ping_rank *r, size_t cap, ping *p, ping_win_sum *s)
+{
+    size_t i;
+
+    if (cap == 0 || (r->len == cap && !ping_dash_worse(s, &r->sum[r->len - 1]))) {
+        return;
+    }
+
+    i = (r->len < cap) ? r->len++ : r->len - 1;
+    for (; i > 0 && ping_dash_worse(s, &r->sum[i - 1]); i--) {
+        r->host[i] = r->host[i - 1];
+        r->sum[i] = r->sum[i - 1];
+    }
+    r->host[i] = p;
+    r->sum[i] = *s;
+}
+
+static void ping_rank_remove(ping_rank *r, ping *p)
+{
+    size_t i;
+
+    for (i = 0; i < r->len && r->host[i] != p; i++) {
+    }
+    if (i == r->len) {
+        return;
+    }
+
+    r->len--;
+    memmove(&r->host[i], &r->host[i + 1], (r->len - i) * sizeof(ping *));
+    memmove(&r->sum[i], &r->sum[i + 1], (r->len - i) * sizeof(ping_win_sum));
+}
+
+static volatile sig_atomic_t reload = false;
+
+static void ping_sighup_handler(int signal)
+{
+    reload = true;
+}
+
+static uint64_t ping_ms(struct timespec ts)
+{
+    return ts.tv_sec * (uint64_t)PING_MS_PER_SEC + ts.tv_nsec / 1000000;
+}
+
+static ping *ping_daemon_demux(void *arg, struct sockaddr_in *addr)
+{
+    ping_daemon *d = arg;
+    ping *p = ping_htab_get(&d->hosts, addr->sin_addr.s_addr);
+
+    /* A reply may open the window of a paced flood */
+    if (p != NULL && d->sock->window) {
+        ping_heap_update(&d->sched, &p->sched, 0);
+    }
+
+    return p;
+}
+
+/* Name p was added by */
+static const char *ping_daemon_name(ping *p)
+{
+    return (p->listed != NULL) ? p->listed : p->dest.name;
+}
+
+/* Host added by hostname, found without resolving it again */
+static ping *ping_daemon_find(ping_daemon *d, const char *hostname)
+{
+    ping *p = ping_htab_get(&d->names_idx, ping_htab_hash_str(hostname));
+
+    if (p != NULL && strcmp(ping_daemon_name(p), hostname) == 0) {
+        return p;
+    }
+
+    return NULL;
+}
+
+/* Removes p from the lookup tables */
+static void ping_daemon_unindex(ping_daemon *d, ping *p)
+{
+    if (ping_daemon_find(d, ping_daemon_name(p)) == p) {
+        ping_htab_del(&d->names_idx, ping_htab_hash_str(ping_daemon_name(p)));
+    }
+    ping_htab_del(&d->hosts, p->dest.addr.sin_addr.s_addr);
+}
+
+/* Starts pinging hostname unless it already is, -1 on error. A name is only
+ * resolved the first time it is added, resolving is slow and would hold
+ * the probes of every host. */
+static int ping_daemon_add(ping_daemon *d, char *hostname)
+{
+    host *dest;
+    host h;
+    ping *p;
+
+    p = ping_daemon_find(d, hostname);
+    if (p != NULL) {
+        p->gen = d->gen;
+        return 0;
+    }
+
+    dest = ping_get_host(hostname);
+    if (dest == NULL) {
+        fprintf (stderr, "unknown host %s\n", hostname);
+        return -1;
+    }
+
+    h.addr = dest->addr;
+    h.name = ping_arena_strdup(&d->names, dest->name);
+    free(dest->name);
+    free(dest);
+    if (h.name == NULL) {
+        return -1;
+    }
+
+    p = ping_htab_get(&d->hosts, h.addr.sin_addr.s_addr);
+    if (p != NULL) {
+        p->gen = d->gen;
+        ping_arena_release(&d->names, h.name);
+        return 0;
+    }
+
+    /* Every host shares the socket and options of the daemon */
+    p = ping_alloc(d->sock, true, &d->target_size);
+    if (p == NULL) {
+        ping_arena_release(&d->names, h.name);
+        return -1;
+    }
+    p->gen = d->gen;
+
+    if (ping_htab_put(&d->hosts, h.addr.sin_addr.s_addr, p) < 0) {
+        goto free_p;
+    }
+    /* The table may have been rebuilt, the ranking starts over */
+    d->next.len = 0;
+    d->rank_it = 0;
+
+    /* Only a cache, failing to fill it just resolves the name again. A name
+     * colliding with another one is not kept. */
+    if (strcmp(hostname, h.name) != 0) {
+        p->listed = ping_arena_strdup(&d->names, hostname);
+    }
+    if ((p->listed != NULL || strcmp(hostname, h.name) == 0) &&
+        ping_htab_get(&d->names_idx, ping_htab_hash_str(hostname)) == NULL) {
+        ping_htab_put(&d->names_idx, ping_htab_hash_str(hostname), p);
+    }
+
+    /* The first requests are spread over the interval, so loading many
+     * hosts does not send them, and get their replies, all at once */
+    ping_reset(p, &h, (d->hosts.len * PING_DAEMON_SPREAD) % d->interval);
+    if (ping_heap_push(&d->sched, &p->sched, ping_ms(p->next_send)) < 0) {
+        ping_daemon_unindex(d, p);
+        if (p->listed != NULL) {
+            ping_arena_release(&d->names, p->listed);
+        }
+        goto free_p;
+    }
+
+    /* The dashboard shows it instead */
+    if (d->dash.fd < 0) {
+        ping_print_header(d->sock, &h);
+    }
+
+    return 0;
+
+free_p:
+    ping_arena_release(&d->names, h.name);
+    free(p);
+    return -1;
+}
+
+static void ping_daemon_del(ping_daemon *d, ping *p)
+{
+    ping_heap_remove(&d->sched, &p->sched);
+    ping_daemon_unindex(d, p);
+    ping_rank_remove(&d->shown, p);
+    ping_rank_remove(&d->next, p);
+    if (d->dash.fd < 0) {
+        ping_print_stat(p);
+    }
+
+    ping_arena_release(&d->names, p->dest.name);
+    if (p->listed != NULL) {
+        ping_arena_release(&d->names, p->listed);
+    }
+    free(p);
+}
+
+/* Names of removed hosts stay in the arena, once they are the most of it
+ * the ones in use are moved to a new one */
+static void ping_daemon_compact(ping_daemon *d)
+{
+    ping_arena names = { 0 };
+    size_t it = 0;
+    ping *p;
+
+    if (d->names.size < 2 * d->names.live + 2 * PING_ARENA_CHUNK) {
+        return;
+    }
+
+    while ((p = ping_htab_next(&d->hosts, &it)) != NULL) {
+        char *name = ping_arena_strdup(&names, p->dest.name);
+        char *listed = NULL;
+
+        if (name != NULL && p->listed != NULL) {
+            listed = ping_arena_strdup(&names, p->listed);
+        }
+        if (name == NULL || (p->listed != NULL && listed == NULL)) {
+            /* Keep the old one, along with the copies the hosts already
+             * moved point to */
+            ping_arena_join(&d->names, &names);
+            return;
+        }
+        p->dest.name = name;
+        p->listed = listed;
+    }
+
+    ping_arena_free(&d->names);
+    d->names = names;
+}
+
+/* Memory held for the hosts: their state, names and lookup structures */
+static void ping_daemon_print_mem(ping_daemon *d, FILE *out)
+{
+    size_t n = d->hosts.len;
+    size_t bytes = n * d->target_size + d->names.size +
+        (d->hosts.cap + d->names_idx.cap) * sizeof(ping_htab_entry) + d->sched.cap * sizeof(ping_heap_node *);
+
+    fprintf (out, "%zu hosts, %zu bytes of state (%zu per host, %zu per ping)\n",
+             n, bytes, n ? bytes / n : 0, d->target_size);
+}
+
+/* Reads the target file, one host per line and # for comments. Returns -1
+ * if it can not be read, leaving the current hosts untouched. */
+static int ping_daemon_reload(ping_daemon *d)
+{
+    FILE *f;
+    char *line = NULL;
+    size_t cap = 0;
+    size_t it = 0;
+    ping *p;
+
+    f = fopen(d->path, "r");
+    if (f == NULL) {
+        fprintf (stderr, "%s: %s\n", d->path, strerror(errno));
+        return -1;
+    }
+
+    d->gen++;
+
+    while (getline(&line, &cap, f) >= 0) {
+        char *name = line + strspn(line, " \t");
+
+        name[strcspn(name, " \t\r\n#")] = '\0';
+        if (*name != '\0') {
+            ping_daemon_add(d, name);
+        }
+    }
+
+    free(line);
+    fclose(f);
+
+    while ((p = ping_htab_next(&d->hosts, &it)) != NULL) {
+        if (p->gen != d->gen) {
+            ping_daemon_del(d, p);
+        }
+    }
+
+    ping_daemon_compact(d);
+
+    return 0;
+}
+
+/* Whether the socket at addr is not a stale one, connecting to it does not
+ * fail with ECONNREFUSED */
+static bool ping_daemon_ctl_alive(const struct sockaddr_un *addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool alive;
+
+    if (fd < 0) {
+        return true;
+    }
+    alive = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0 ||
+            errno != ECONNREFUSED;
+    close(fd);
+
+    return alive;
+}
+
+static int ping_daemon_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* A previous run may have left its socket behind. Only a socket nobody
+     * listens on is removed, anything else is in use. */
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode) || ping_daemon_ctl_alive(&addr)) {
+            close(fd);
+            errno = EADDRINUSE;
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Commands are served from the poll() loop, where resolving a name would
+ * hold the probes of every host. Only the names already listed and numeric
+ * addresses are accepted there. */
+static bool ping_daemon_numeric(const char *arg)
+{
+    struct in_addr addr;
+
+    return inet_aton(arg, &addr) != 0;
+}
+
+/* Runs a control command, writing its answer to out:
+ *   add <host>, del <host>, reload, list, stats */
+static void ping_daemon_command(ping_daemon *d, char *cmd, FILE *out)
+{
+    char *arg;
+
+    cmd[strcspn(cmd, "\r\n")] = '\0';
+    arg = strchr(cmd, ' ');
+    if (arg != NULL) {
+        *arg++ = '\0';
+    }
+
+    if (strcmp(cmd, "add") == 0 && arg != NULL) {
+        if (ping_daemon_find(d, arg) == NULL && !ping_daemon_numeric(arg)) {
+            fprintf (out, "error: %s is not a numeric address\n", arg);
+        }
+        else if (ping_daemon_add(d, arg) == 0) {
+            fprintf (out, "ok\n");
+        }
+        else {
+            fprintf (out, "error: unknown host %s\n", arg);
+        }
+    }
+    else if (strcmp(cmd, "del") == 0 && arg != NULL) {
+        ping *p = ping_daemon_find(d, arg);
+        host *h = NULL;
+
+        if (p == NULL && ping_daemon_numeric(arg)) {
+            h = ping_get_host(arg);
+        }
+        if (h != NULL) {
+            p = ping_htab_get(&d->hosts, h->addr.sin_addr.s_addr);
+            free(h->name);
+            free(h);
+        }
+        if (p != NULL) {
+            ping_daemon_del(d, p);
+            fprintf (out, "ok\n");
+        }
+        else {
+            fprintf (out, "error: not pinging %s\n", arg);
+        }
+    }
+    else if (strcmp(cmd, "reload") == 0) {
+        if (ping_daemon_reload(d) == 0) {
+            fprintf (out, "ok\n");
+        }
+        else {
+            fprintf (out, "error: %s\n", strerror(errno));
+        }
+    }
+    else if (strcmp(cmd, "list") == 0) {
+        size_t it = 0;
+        ping *p;
+
+        while ((p = ping_htab_next(&d->hosts, &it)) != NULL) {
+            fprintf (out, "%s %s %" PRIu32 " sent %" PRIu32 " received\n",
+                     inet_ntoa(p->dest.addr.sin_addr), p->dest.name, p->num_sent,
+                     p->num_recv);
+        }
+    }
+    else if (strcmp(cmd, "stats") == 0) {
+        ping_daemon_print_mem(d, out);
+    }
+    else {
+        fprintf (out, "error: unknown command\n");
+    }
+
+}
+
+static void ping_daemon_ctl_close(ping_ctl *c)
+{
+    close(c->fd);
+    free(c->reply);
+    c->fd = -1;
+    c->reply = NULL;
+}
+
+/* Takes a new client of the control socket, dropping the oldest one when
+ * they are too many */
+static void ping_daemon_accept(ping_daemon *d)
+{
+    ping_ctl *c = &d->ctl[0];
+    size_t i;
+    int fd;
+
+    fd = accept4(d->ctl_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    for (i = 0; i < PING_CTL_CLIENTS; i++) {
+        if (d->ctl[i].fd < 0) {
+            c = &d->ctl[i];
+            break;
+        }
+        if ((int)(d->ctl[i].serial - c->serial) < 0) {
+            c = &d->ctl[i];
+        }
+    }
+    if (c->fd >= 0) {
+        ping_daemon_ctl_close(c);
+    }
+
+    c->fd = fd;
+    c->serial = d->ctl_serial++;
+    c->len = 0;
+    c->reply_len = 0;
+    c->reply_off = 0;
+}
+
+/* Serves a client of the control socket. Each connection sends a single
+ * command, ended by a newline or by closing its side, and gets the answer
+ * before being closed. */
+static void ping_daemon_ctl_io(ping_daemon *d, ping_ctl *c)
+{
+    if (c->reply == NULL) {
+        ssize_t len = recv(c->fd, c->cmd + c->len, sizeof(c->cmd) - 1 - c->len, 0);
+        FILE *out;
+
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                ping_daemon_ctl_close(c);
+            }
+            return;
+        }
+        c->len += len;
+        c->cmd[c->len] = '\0';
+
+        if (len > 0 && strchr(c->cmd, '\n') == NULL && c->len < sizeof(c->cmd) - 1) {
+            return;
+        }
+        if (c->len == 0) {
+            ping_daemon_ctl_close(c);
+            return;
+        }
+
+        out = open_memstream(&c->reply, &c->reply_len);
+        if (out == NULL) {
+            ping_daemon_ctl_close(c);
+            return;
+        }
+        if (len > 0 && strchr(c->cmd, '\n') == NULL) {
+            fprintf (out, "error: command too long\n");
+        }
+        else {
+            ping_daemon_command(d, c->cmd, out);
+        }
+        fclose(out);
+        /* Errors may have been written over it */
+        d->dash.full = true;
+    }
+
+    while (c->reply_off < c->reply_len) {
+        ssize_t len = send(c->fd, c->reply + c->reply_off, c->reply_len - c->reply_off,
+                           MSG_NOSIGNAL);
+
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                ping_daemon_ctl_close(c);
+            }
+            return;
+        }
+        c->reply_off += len;
+    }
+
+    ping_daemon_ctl_close(c);
+}
+
+static void ping_daemon_rank_free(ping_daemon *d)
+{
+    free(d->shown.host);
+    free(d->next.host);
+    memset(&d->shown, 0, sizeof(ping_rank));
+    memset(&d->next, 0, sizeof(ping_rank));
+    d->rank_cap = 0;
+}
+
+/* Ranks the next PING_DASH_SLICE hosts. Looking at all of them at once
+ * would stall the receive path for long with many hosts, so a ranking is
+ * built a slice per loop and the frames show the last complete one, with
+ * their values up to date. Every PING_DASH_RANK frames a new one starts. */
+static void ping_daemon_rank(ping_daemon *d)
+{
+    size_t room = (d->dash.rows > 3) ? d->dash.rows - 3 : 0;
+    ping_win_sum s;
+    ping_rank swap;
+    size_t i;
+    ping *p;
+
+    /* As many as fit between the column names and the last row */
+    if (room != d->rank_cap) {
+        ping_daemon_rank_free(d);
+        d->shown.host = malloc(room * (sizeof(ping *) + sizeof(ping_win_sum)));
+        d->next.host = malloc(room * (sizeof(ping *) + sizeof(ping_win_sum)));
+        if (d->shown.host == NULL || d->next.host == NULL) {
+            ping_daemon_rank_free(d);
+            return;
+        }
+        d->shown.sum = (ping_win_sum *)(d->shown.host + room);
+        d->next.sum = (ping_win_sum *)(d->next.host + room);
+        d->rank_cap = room;
+        d->rank_it = 0;
+    }
+
+    for (i = 0; i < PING_DASH_SLICE; i++) {
+        p = ping_htab_next(&d->hosts, &d->rank_it);
+        if (p == NULL) {
+            swap = d->shown;
+            d->shown = d->next;
+            d->next = swap;
+            d->next.len = 0;
+            d->rank_it = 0;
+            d->ranking = false;
+            return;
+        }
+
+        ping_win_summary(p->win, ping_dash_tick, &s);
+        ping_rank_insert(&d->next, d->rank_cap, p, &s);
+    }
+}
+
+/* Draws a frame with the worst hosts of the last ranking */
+static void ping_daemon_draw(ping_daemon *d, struct timespec now)
+{
+    ping_win_sum s;
+    char title[256];
+    size_t i;
+    int row;
+
+    ping_dash_begin(&d->dash, now);
+
+    snprintf(title, sizeof(title), "%s: %zu hosts", d->path, d->hosts.len);
+    row = ping_dash_header(&d->dash, title);
+
+    for (i = 0; i < d->shown.len; i++) {
+        ping_win_summary(d->shown.host[i]->win, ping_dash_tick, &s);
+        ping_dash_host(&d->dash, row + i, d->shown.host[i], &s);
+    }
+    if (d->shown.len < d->hosts.len) {
+        ping_dash_text(&d->dash, row + d->shown.len, 0, "... %zu more hosts",
+                       d->hosts.len - d->shown.len);
+    }
+
+    ping_dash_flush(&d->dash);
+    if (++d->frames % PING_DASH_RANK == 0) {
+        d->ranking = true;
+    }
+}
+
+/* This function return will be the exit status of the program itself */
+int ping_daemon_run(ping_daemon *d)
+{
+    int ret = 0;
+    size_t it;
+    struct pollfd pfd[2 + PING_CTL_CLIENTS];
+    struct timespec now;
+    ping *p;
+
+    d->dash.fd = -1;
+    if (ping_htab_init(&d->hosts, 0) < 0 || ping_htab_init(&d->names_idx, 0) < 0) {
+        perror("ping_daemon");
+        ping_htab_free(&d->hosts);
+        return 1;
+    }
+
+    /* Output is usually logged, keep it in order with the errors */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    /* Every host shares the socket */
+    d->sock->demux = ping_daemon_demux;
+    d->sock->demux_arg = d;
+
+    d->ctl_fd = -1;
+    for (it = 0; it < PING_CTL_CLIENTS; it++) {
+        d->ctl[it].fd = -1;
+    }
+    if (d->ctl_path != NULL) {
+        d->ctl_fd = ping_daemon_listen(d->ctl_path);
+        if (d->ctl_fd < 0) {
+            fprintf (stderr, "%s: %s\n", d->ctl_path, strerror(errno));
+            ret = 1;
+            goto exit_clean;
+        }
+    }
+
+    /* Loading many hosts takes a while, signals are caught meanwhile */
+    signal(SIGINT, ping_sigint_handler);
+    signal(SIGHUP, ping_sighup_handler);
+    if (d->sock->options & OPT_SELF_STATS) {
+        signal(SIGUSR1, ping_sigusr1_handler);
+    }
+
+    if (ping_daemon_reload(d) < 0) {
+        ret = 1;
+        goto exit_clean;
+    }
+
+    /* Opened once the hosts are loaded, so their errors stay visible */
+    if (d->sock->options & OPT_DASHBOARD) {
+        if (ping_dash_start(&d->dash, d->interval) < 0) {
+            ret = 1;
+            goto exit_clean;
+        }
+        d->ranking = true;
+    }
+
+    pfd[0].fd = d->sock->fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = d->ctl_fd;
+    pfd[1].events = POLLIN;
+
+    while (!done) {
+        ping_heap_node *next;
+        int wait = -1;
+        int pret;
+        uint64_t start;
+
+        if (self_stats) {
+            self_stats = false;
+            ping_prof_print(stderr);
+            ping_daemon_print_mem(d, stderr);
+            d->dash.full = true;
+        }
+
+        if (reload) {
+            reload = false;
+            ping_daemon_reload(d);
+            /* Errors may have been written over it */
+            d->dash.full = true;
+        }
+
+        if (resized && d->dash.fd >= 0) {
+            resized = false;
+            ping_dash_resize(&d->dash);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        /* Only the hosts with something due are looked at. Errors sending to
+         * a host do not stop the others. A pass looks at most at as many
+         * hosts as there are, so one always due cannot keep the replies and
+         * signals waiting. */
+        for (it = d->sched.len; it > 0 && !done; it--) {
+            int w;
+
+            next = ping_heap_min(&d->sched);
+            if (next == NULL || next->key > ping_ms(now)) {
+                break;
+            }
+
+            p = (ping *)((uint8_t *)next - offsetof(ping, sched));
+
+            ping_tw_expire(&p->tw, now, ping_timeout, p);
+            if (ping_step(p, 0, now, d->interval) < 0) {
+                fprintf (stderr, "sendto %s: %s\n", inet_ntoa(p->dest.addr.sin_addr),
+                         strerror(errno));
+            }
+
+            /* Without count the host always has a next send */
+            w = ping_next_wait(p, now);
+            if (w < 0) {
+                w = PING_MAX_WAIT;
+            }
+            ping_heap_update(&d->sched, next, ping_ms(now) + w);
+        }
+
+        next = ping_heap_min(&d->sched);
+        if (next != NULL) {
+            wait = (next->key > ping_ms(now)) ? (int)(next->key - ping_ms(now)) : 0;
+        }
+        /* Clients wait for their command, then for room for the reply */
+        for (it = 0; it < PING_CTL_CLIENTS; it++) {
+            pfd[2 + it].fd = d->ctl[it].fd;
+            pfd[2 + it].events = (d->ctl[it].reply == NULL) ? POLLIN : POLLOUT;
+        }
+
+        if (d->dash.fd >= 0) {
+            /* The rest of a ranking is only put off to receive */
+            int w = d->ranking ? 0 : ping_dash_wait(&d->dash, now);
+
+            if (wait < 0 || w < wait) {
+                wait = w;
+            }
+        }
+
+        start = ping_prof_now();
+        pret = poll(pfd, ARRAY_SIZE(pfd), wait);
+        ping_prof_add(PING_PROF_POLL, start);
+        ping_prof_counters.sys_poll++;
+        if (pret < 0) {
+            ping_prof_errno();
+            if (errno == EINTR) {
+                continue;
+            }
+            ret = 1;
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if (pfd[0].revents & POLLERR) {
+            ping_recv_errors(d->sock, ping_daemon_demux, d);
+        }
+        if (pfd[0].revents & POLLIN) {
+            start = ping_prof_now();
+            ping_recv(d->sock, PING_RECV_BATCH, ping_daemon_demux, d);
+            ping_prof_add(PING_PROF_RECV, start);
+        }
+        for (it = 0; it < PING_CTL_CLIENTS; it++) {
+            if (d->ctl[it].fd >= 0 && pfd[2 + it].fd == d->ctl[it].fd &&
+                pfd[2 + it].revents) {
+                ping_daemon_ctl_io(d, &d->ctl[it]);
+            }
+        }
+        if (pfd[1].revents & POLLIN) {
+            ping_daemon_accept(d);
+        }
+
+        if (d->dash.fd >= 0) {
+            if (d->ranking) {
+                ping_daemon_rank(d);
+            }
+            if (ping_dash_wait(&d->dash, now) == 0) {
+                ping_daemon_draw(d, now);
+            }
+        }
+    }
+
+    /* Closed first, what follows is printed after it */
+    if (d->dash.fd >= 0) {
+        ping_dash_stop(&d->dash);
+        ping_daemon_rank_free(d);
+    }
+
+    if (d->sock->options & OPT_SELF_STATS) {
+        ping_daemon_print_mem(d, stderr);
+    }
+
+exit_clean:
+    it = 0;
+    while ((p = ping_htab_next(&d->hosts, &it)) != NULL) {
+        ping_daemon_del(d, p);
+    }
+    ping_htab_free(&d->hosts);
+    ping_htab_free(&d->names_idx);
+    ping_heap_free(&d->sched);
+    ping_arena_free(&d->names);
+
+    for (it = 0; it < PING_CTL_CLIENTS; it++) {
+        if (d->ctl[it].fd >= 0) {
+            ping_daemon_ctl_close(&d->ctl[it]);
+        }
+    }
+    if (d->ctl_fd >= 0) {
+        close(d->ctl_fd);
+        unlink(d->ctl_path);
+    }
+
+    return ret;
+}
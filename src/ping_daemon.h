@@ -0,0 +1,58 @@
+#ifndef PING_DAEMON_H
+#define PING_DAEMON_H
+
+#include "ping.h"
+#include "ping_htab.h"
+
+#define PING_CTL_CLIENTS		4		/* Control connections served at once */
+#define PING_CTL_LINE			256		/* Longest control command */
+
+/* Hosts of the dashboard, the worst first */
+typedef struct ping_rank_s {
+    ping        **host;
+    ping_win_sum *sum;
+    size_t        len;
+} ping_rank;
+
+/* Connection to the control socket of the daemon. The command is read and
+ * the reply written as the socket allows, so a slow client never holds the
+ * probes. */
+typedef struct ping_ctl_s {
+    int          fd;              /* -1 when unused */
+    unsigned     serial;          /* order of accept, the oldest goes first */
+    size_t       len;             /* bytes of cmd read */
+    char         cmd[PING_CTL_LINE];
+    char        *reply;           /* NULL until the command is complete */
+    size_t       reply_len;
+    size_t       reply_off;       /* bytes of reply written */
+} ping_ctl;
+
+/* Daemon mode: the hosts listed in a file are pinged continuously through
+ * the socket of a single profile and replies are dispatched by source
+ * address. On reload new hosts are started and the ones no longer listed
+ * stopped, the rest keep probing with their state untouched. */
+typedef struct ping_daemon_s {
+    ping_sock   *sock;            /* socket and options shared by every host */
+    ping_htab    hosts;           /* address -> ping */
+    ping_htab    names_idx;       /* hash of the name as listed -> ping */
+    ping_heap    sched;           /* hosts by time of their next event */
+    ping_arena   names;
+    size_t       target_size;     /* bytes of each ping */
+    const char  *path;            /* file with one host per line */
+    const char  *ctl_path;        /* control socket path, NULL if none */
+    int          ctl_fd;
+    ping_ctl     ctl[PING_CTL_CLIENTS];
+    unsigned     ctl_serial;
+    int          interval;
+    unsigned     gen;             /* current reload */
+    ping_dash    dash;            /* fd < 0 when not shown */
+    ping_rank    shown;           /* worst hosts, last complete ranking */
+    ping_rank    next;            /* ranking being built */
+    size_t       rank_cap;
+    size_t       rank_it;         /* next host to rank */
+    bool         ranking;         /* a ranking is being built */
+    unsigned     frames;
+} ping_daemon;
+
+int ping_daemon_run(ping_daemon *d);
+#endif
@@ -0,0 +1,365 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ping_dash.h"
+#include "ping_utils.h"
+
+#define PING_DASH_MAX_COLS	512
+
+uint32_t ping_dash_tick;
+
+/* Moves the window to tick, clearing the buckets it leaves behind */
+void ping_win_advance(ping_win *w, uint32_t tick)
+{
+    uint32_t t;
+
+    if (tick - w->tick >= PING_WIN_BUCKETS) {
+        memset(&w->total, 0, sizeof(w->total));
+        memset(w->bucket, 0, sizeof(w->bucket));
+        memset(w->hist, 0, sizeof(w->hist));
+        w->tick = tick;
+        return;
+    }
+
+    for (t = w->tick; t != tick;) {
+        ping_win_bucket *b = &w->bucket[++t & (PING_WIN_BUCKETS - 1)];
+
+        w->total.recv -= b->recv;
+        w->total.lost -= b->lost;
+        w->total.tsum -= b->tsum;
+        memset(b, 0, sizeof(ping_win_bucket));
+        if (t % PING_WIN_HALF == 0) {
+            memset(w->hist[(t / PING_WIN_HALF) & 1], 0, sizeof(w->hist[0]));
+        }
+    }
+    w->tick = tick;
+}
+
+/* Accounts a request that timed out or got an error */
+void ping_win_lost(ping_win *w, uint32_t tick)
+{
+    if (w->tick != tick) {
+        ping_win_advance(w, tick);
+    }
+    w->bucket[tick & (PING_WIN_BUCKETS - 1)].lost++;
+    w->total.lost++;
+}
+
+/* Totals of the window ending at tick */
+void ping_win_summary(ping_win *w, uint32_t tick, ping_win_sum *s)
+{
+    if (w->tick != tick) {
+        ping_win_advance(w, tick);
+    }
+
+    s->recv = w->total.recv;
+    s->lost = w->total.lost;
+    s->avg = s->recv ? w->total.tsum / s->recv : 0;
+    s->last = s->recv ? w->last : 0;
+}
+
+/* Upper bound of the histogram bin holding the 99th percentile, 0 without
+ * replies. Expects the window to be at the current tick. */
+uint64_t ping_win_p99(ping_win *w)
+{
+    uint32_t total = 0;
+    uint32_t want, seen = 0;
+    int i;
+
+    for (i = 0; i < PING_WIN_BINS; i++) {
+        total += w->hist[0][i] + w->hist[1][i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    want = total - total / 100;
+    for (i = 0; i < PING_WIN_BINS; i++) {
+        seen += w->hist[0][i] + w->hist[1][i];
+        if (seen >= want) {
+            break;
+        }
+    }
+    return (((uint64_t)PING_WIN_SUBBINS + 1 + i % PING_WIN_SUBBINS)
+            << (i / PING_WIN_SUBBINS)) * 1000 / PING_WIN_SUBBINS;
+}
+
+/* Takes the terminal on fd, drawing on the alternate screen so what was on
+ * it is back once the dashboard is closed. Returns -1 if fd is not a
+ * terminal or on allocation failure. */
+int ping_dash_open(ping_dash *d, int fd, unsigned bucket_ms)
+{
+    static const char enter[] = "\033[?1049h\033[?25l";
+
+    memset(d, 0, sizeof(ping_dash));
+    d->fd = fd;
+    d->bucket_ms = bucket_ms;
+
+    if (ping_dash_resize(d) < 0) {
+        ping_dash_close(d);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &d->start);
+    d->next = d->start;
+    ping_dash_tick = 0;
+
+    if (write(d->fd, enter, sizeof(enter) - 1) < 0) {
+        ping_dash_close(d);
+        return -1;
+    }
+
+    return 0;
+}
+
+void ping_dash_close(ping_dash *d)
+{
+    static const char leave[] = "\033[?25h\033[?1049l";
+
+    if (d->fd < 0) {
+        return;
+    }
+
+    /* The screen was only taken once its size is known */
+    if (d->rows > 0 && write(d->fd, leave, sizeof(leave) - 1) < 0) {
+        /* Nothing left to do about it */
+    }
+    free(d->cur);
+    free(d->prev);
+    free(d->out);
+    d->cur = d->prev = NULL;
+    d->out = NULL;
+    d->fd = -1;
+}
+
+/* Reads the size of the terminal again, the next frame redraws everything */
+int ping_dash_resize(ping_dash *d)
+{
+    struct winsize ws;
+    int rows, cols;
+    size_t cells, out_size;
+    uint32_t *cur, *prev;
+    char *out;
+
+    if (ioctl(d->fd, TIOCGWINSZ, &ws) < 0) {
+        return -1;
+    }
+    if (ws.ws_row == 0 || ws.ws_col == 0) {
+        errno = ENOTTY;
+        return -1;
+    }
+
+    rows = ws.ws_row;
+    cols = (ws.ws_col < PING_DASH_MAX_COLS) ? ws.ws_col : PING_DASH_MAX_COLS;
+    cells = (size_t)rows * cols;
+
+    /* Each cell is at most 3 bytes of UTF-8 and each row may need a cursor
+     * move. Buffers that grew are kept even if a later one fails. */
+    out_size = cells * 3 + rows * 16 + 16;
+    cur = realloc(d->cur, cells * sizeof(uint32_t));
+    if (cur != NULL) {
+        d->cur = cur;
+    }
+    prev = realloc(d->prev, cells * sizeof(uint32_t));
+    if (prev != NULL) {
+        d->prev = prev;
+    }
+    out = realloc(d->out, out_size);
+    if (out != NULL) {
+        d->out = out;
+    }
+    if (cur == NULL || prev == NULL || out == NULL) {
+        return -1;
+    }
+
+    d->rows = rows;
+    d->cols = cols;
+    d->out_size = out_size;
+    d->full = true;
+
+    return 0;
+}
+
+/* Milliseconds until the next frame is due, 0 if it already is */
+int ping_dash_wait(ping_dash *d, struct timespec now)
+{
+    struct timespec left = timespec_normalise(timespec_substract(d->next, now));
+
+    if (left.tv_sec < 0) {
+        return 0;
+    }
+
+    return left.tv_sec * 1000 + (left.tv_nsec + 999999) / 1000000;
+}
+
+/* Starts a frame: the windows move to the current bucket and the cells are
+ * blanked. Frames keep a fixed rate, a late one does not make the next
+ * ones come sooner. */
+void ping_dash_begin(ping_dash *d, struct timespec now)
+{
+    size_t i;
+
+    ping_dash_tick = timespec_to_ms(timespec_substract(now, d->start)) / d->bucket_ms;
+
+    d->next = timespec_normalise(timespec_add(d->next, ms_to_timespec(PING_DASH_REFRESH)));
+    if (ping_dash_wait(d, now) == 0) {
+        d->next = timespec_normalise(timespec_add(now, ms_to_timespec(PING_DASH_REFRESH)));
+    }
+
+    for (i = 0; i < (size_t)d->rows * d->cols; i++) {
+        d->cur[i] = ' ';
+    }
+}
+
+/* Writes formatted ASCII text at row and col, clipped to the screen.
+ * Returns the column following it. */
+int ping_dash_text(ping_dash *d, int row, int col, const char *fmt, ...)
+{
+    char buf[PING_DASH_MAX_COLS + 1];
+    va_list ap;
+    int len;
+    int i;
+
+    if (row < 0 || row >= d->rows) {
+        return col;
+    }
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return col;
+    }
+    if (len > (int)sizeof(buf) - 1) {
+        len = sizeof(buf) - 1;
+    }
+
+    for (i = 0; i < len && col + i < d->cols; i++) {
+        d->cur[row * d->cols + col + i] = (unsigned char)buf[i];
+    }
+
+    return col + len;
+}
+
+/* Draws the average round trip of each bucket of w, oldest first, scaled
+ * between the lowest and the highest of them. Buckets with losses and no
+ * replies are marked with '!'. */
+void ping_dash_spark(ping_dash *d, int row, int col, ping_win *w)
+{
+    uint64_t avg[PING_WIN_BUCKETS];
+    uint64_t lo = UINT64_MAX;
+    uint64_t hi = 0;
+    int i;
+
+    if (row < 0 || row >= d->rows) {
+        return;
+    }
+
+    for (i = 0; i < PING_WIN_BUCKETS; i++) {
+        ping_win_bucket *b = &w->bucket[(w->tick + 1 + i) & (PING_WIN_BUCKETS - 1)];
+
+        avg[i] = b->recv ? b->tsum / b->recv : 0;
+        if (b->recv && avg[i] < lo) {
+            lo = avg[i];
+        }
+        if (b->recv && avg[i] > hi) {
+            hi = avg[i];
+        }
+    }
+
+    for (i = 0; i < PING_WIN_BUCKETS && col + i < d->cols; i++) {
+        ping_win_bucket *b = &w->bucket[(w->tick + 1 + i) & (PING_WIN_BUCKETS - 1)];
+        uint32_t cp = ' ';
+
+        if (b->recv) {
+            /* U+2581 to U+2588, lower one eighth block to full block */
+            cp = 0x2581 + ((hi > lo) ? (avg[i] - lo) * 7 / (hi - lo) : 0);
+        }
+        else if (b->lost) {
+            cp = '!';
+        }
+        d->cur[row * d->cols + col + i] = cp;
+    }
+}
+
+static size_t ping_dash_utf8(uint32_t cp, char *s)
+{
+    if (cp < 0x80) {
+        s[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        s[0] = 0xC0 | (cp >> 6);
+        s[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    s[0] = 0xE0 | (cp >> 12);
+    s[1] = 0x80 | ((cp >> 6) & 0x3F);
+    s[2] = 0x80 | (cp & 0x3F);
+    return 3;
+}
+
+/* Writes out the cells of each row between the first and the last one that
+ * changed since the previous frame, with a single write() per frame. An
+ * unchanged frame costs no syscall at all. */
+void ping_dash_flush(ping_dash *d)
+{
+    size_t len = 0;
+    uint32_t *swap;
+    int row;
+
+    if (d->full) {
+        len += snprintf(d->out, d->out_size, "\033[H\033[2J");
+    }
+
+    for (row = 0; row < d->rows; row++) {
+        uint32_t *cur = &d->cur[row * d->cols];
+        uint32_t *prev = &d->prev[row * d->cols];
+        int first = 0;
+        int last = d->cols - 1;
+        int col;
+
+        if (!d->full) {
+            while (first < d->cols && cur[first] == prev[first]) {
+                first++;
+            }
+            if (first == d->cols) {
+                continue;
+            }
+            while (cur[last] == prev[last]) {
+                last--;
+            }
+        }
+        else {
+            /* The screen is blank, trailing spaces can be skipped */
+            while (last >= 0 && cur[last] == ' ') {
+                last--;
+            }
+            if (last < 0) {
+                continue;
+            }
+        }
+
+        len += snprintf(d->out + len, d->out_size - len, "\033[%d;%dH", row + 1, first + 1);
+        for (col = first; col <= last; col++) {
+            len += ping_dash_utf8(cur[col], d->out + len);
+        }
+    }
+
+    d->full = false;
+    swap = d->prev;
+    d->prev = d->cur;
+    d->cur = swap;
+
+    if (len > 0 && write(d->fd, d->out, len) < 0) {
+        /* The terminal is gone, it is not worth stopping the probes */
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef PING_DASH_H
+#define PING_DASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PING_WIN_BUCKETS	16	/* Buckets of a window, a power of 2 */
+#define PING_WIN_HALF		(PING_WIN_BUCKETS / 2)
+#define PING_WIN_SUBBINS	4	/* Histogram bins per octave */
+#define PING_WIN_BINS		(24 * PING_WIN_SUBBINS)	/* 1 us to 16 s */
+#define PING_DASH_REFRESH	250	/* Milliseconds between frames */
+
+/* Replies and losses of one bucket, round trips in nanoseconds */
+typedef struct ping_win_bucket_s {
+    uint32_t recv;
+    uint32_t lost;
+    uint64_t tsum;
+} ping_win_bucket;
+
+/* Windowed statistics of a target, kept per bucket of ticks so reading them
+ * does not depend on how many replies there were. The totals of the window
+ * are kept along, so summing it does not touch the buckets. The latency
+ * histogram is split in two halves of the window, the oldest one being
+ * cleared when the window enters it again, so the percentile covers between
+ * half and all of the window. */
+typedef struct ping_win_s {
+    uint32_t        tick;         /* tick of the newest bucket */
+    uint64_t        last;         /* last round trip */
+    ping_win_bucket total;        /* sum of the buckets */
+    ping_win_bucket bucket[PING_WIN_BUCKETS];
+    uint32_t        hist[2][PING_WIN_BINS];
+} ping_win;
+
+typedef struct ping_win_sum_s {
+    uint32_t recv;
+    uint32_t lost;
+    uint64_t avg;                 /* nanoseconds, 0 without replies */
+    uint64_t last;
+} ping_win_sum;
+
+/* Terminal dashboard. Frames are drawn into cur, one code point per cell,
+ * and only the cells differing from the previous frame are written out. */
+typedef struct ping_dash_s {
+    int       fd;
+    int       rows;
+    int       cols;
+    uint32_t *cur;
+    uint32_t *prev;
+    bool      full;               /* the screen must be redrawn entirely */
+    char     *out;
+    size_t    out_size;
+    unsigned  bucket_ms;          /* duration of a window bucket */
+    struct timespec start;
+    struct timespec next;         /* next frame */
+} ping_dash;
+
+/* Current bucket of every window, advanced with each frame */
+extern uint32_t ping_dash_tick;
+
+void ping_win_advance(ping_win *w, uint32_t tick);
+void ping_win_lost(ping_win *w, uint32_t tick);
+void ping_win_summary(ping_win *w, uint32_t tick, ping_win_sum *s);
+uint64_t ping_win_p99(ping_win *w);
+
+/* Accounts a reply, the only part of the dashboard on the receive path */
+static inline void ping_win_add(ping_win *w, uint32_t tick, uint64_t rtt)
+{
+    uint64_t us = rtt / 1000;
+    unsigned bin = 0;
+
+    if (w->tick != tick) {
+        ping_win_advance(w, tick);
+    }
+
+    /* Logarithmic bins, PING_WIN_SUBBINS linear ones per power of 2 */
+    if (us > 0) {
+        unsigned o = 63 - __builtin_clzll(us);
+        unsigned sub = (o >= 2) ? (us >> (o - 2)) : (us << (2 - o));
+
+        bin = o * PING_WIN_SUBBINS + (sub & (PING_WIN_SUBBINS - 1));
+        if (bin >= PING_WIN_BINS) {
+            bin = PING_WIN_BINS - 1;
+        }
+    }
+
+    w->bucket[tick & (PING_WIN_BUCKETS - 1)].recv++;
+    w->bucket[tick & (PING_WIN_BUCKETS - 1)].tsum += rtt;
+    w->total.recv++;
+    w->total.tsum += rtt;
+    w->hist[(tick / PING_WIN_HALF) & 1][bin]++;
+    w->last = rtt;
+}
+
+int ping_dash_open(ping_dash *d, int fd, unsigned bucket_ms);
+void ping_dash_close(ping_dash *d);
+int ping_dash_resize(ping_dash *d);
+int ping_dash_wait(ping_dash *d, struct timespec now);
+void ping_dash_begin(ping_dash *d, struct timespec now);
+int ping_dash_text(ping_dash *d, int row, int col, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+void ping_dash_spark(ping_dash *d, int row, int col, ping_win *w);
+void ping_dash_flush(ping_dash *d);
+#endif
@@ -0,0 +1,106 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ping_heap.h"
+
+static void ping_heap_swap(ping_heap *h, size_t a, size_t b)
+{
+    ping_heap_node *n = h->v[a];
+
+    h->v[a] = h->v[b];
+    h->v[b] = n;
+    h->v[a]->idx = a;
+    h->v[b]->idx = b;
+}
+
+static void ping_heap_up(ping_heap *h, size_t i)
+{
+    while (i > 0 && h->v[(i - 1) / 2]->key > h->v[i]->key) {
+        ping_heap_swap(h, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void ping_heap_down(ping_heap *h, size_t i)
+{
+    for (;;) {
+        size_t min = i;
+        size_t l = 2 * i + 1;
+        size_t r = 2 * i + 2;
+
+        if (l < h->len && h->v[l]->key < h->v[min]->key) {
+            min = l;
+        }
+        if (r < h->len && h->v[r]->key < h->v[min]->key) {
+            min = r;
+        }
+        if (min == i) {
+            return;
+        }
+        ping_heap_swap(h, i, min);
+        i = min;
+    }
+}
+
+int ping_heap_push(ping_heap *h, ping_heap_node *n, uint64_t key)
+{
+    if (h->len == h->cap) {
+        size_t cap = h->cap ? h->cap * 2 : 64;
+        ping_heap_node **v = realloc(h->v, cap * sizeof(ping_heap_node *));
+
+        if (v == NULL) {
+            return -1;
+        }
+        h->v = v;
+        h->cap = cap;
+    }
+
+    n->key = key;
+    n->idx = h->len;
+    h->v[h->len++] = n;
+    ping_heap_up(h, n->idx);
+
+    return 0;
+}
+
+void ping_heap_update(ping_heap *h, ping_heap_node *n, uint64_t key)
+{
+    uint64_t old = n->key;
+
+    n->key = key;
+    if (key < old) {
+        ping_heap_up(h, n->idx);
+    }
+    else {
+        ping_heap_down(h, n->idx);
+    }
+}
+
+void ping_heap_remove(ping_heap *h, ping_heap_node *n)
+{
+    size_t i = n->idx;
+
+    h->len--;
+    if (i == h->len) {
+        return;
+    }
+
+    h->v[i] = h->v[h->len];
+    h->v[i]->idx = i;
+    ping_heap_up(h, i);
+    ping_heap_down(h, h->v[i]->idx);
+}
+
+/* Returns the node with the earliest deadline, NULL if empty */
+ping_heap_node *ping_heap_min(ping_heap *h)
+{
+    return (h->len > 0) ? h->v[0] : NULL;
+}
+
+void ping_heap_free(ping_heap *h)
+{
+    free(h->v);
+    h->v = NULL;
+    h->len = h->cap = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef PING_HEAP_H
+#define PING_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Node of a ping_heap, embedded in the scheduled object */
+typedef struct ping_heap_node_s {
+    uint64_t key;               /* deadline */
+    size_t   idx;               /* position in the heap */
+} ping_heap_node;
+
+/* Binary min-heap of deadlines, to wake up only the owners of the timers
+ * that are due when there are too many to look at each of them */
+typedef struct ping_heap_s {
+    ping_heap_node **v;
+    size_t           len;
+    size_t           cap;
+} ping_heap;
+
+int ping_heap_push(ping_heap *h, ping_heap_node *n, uint64_t key);
+void ping_heap_update(ping_heap *h, ping_heap_node *n, uint64_t key);
+void ping_heap_remove(ping_heap *h, ping_heap_node *n);
+ping_heap_node *ping_heap_min(ping_heap *h);
+void ping_heap_free(ping_heap *h);
+#endif
@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ping_htab.h"
+
+static char ping_htab_deleted;
+#define PING_HTAB_DELETED ((void *)&ping_htab_deleted)
+
+static size_t ping_htab_hash(ping_htab *t, uint32_t key)
+{
+    /* Fibonacci hashing takes the high bits of the product, the low ones
+     * only depend on the low bits of the key: the first byte of an address
+     * in network order, the same for a whole subnet */
+    return (uint32_t)(key * 2654435761u) >> (32 - __builtin_ctzl(t->cap));
+}
+
+/* Returns the slot holding key, or the slot where it should be inserted */
+static ping_htab_entry *ping_htab_find(ping_htab *t, uint32_t key)
+{
+    ping_htab_entry *tomb = NULL;
+    size_t i = ping_htab_hash(t, key);
+
+    for (;; i = (i + 1) & (t->cap - 1)) {
+        ping_htab_entry *e = &t->ent[i];
+
+        if (e->val == NULL) {
+            return (tomb != NULL) ? tomb : e;
+        }
+        if (e->val == PING_HTAB_DELETED) {
+            if (tomb == NULL) {
+                tomb = e;
+            }
+        }
+        else if (e->key == key) {
+            return e;
+        }
+    }
+}
+
+static int ping_htab_resize(ping_htab *t, size_t cap)
+{
+    ping_htab old = *t;
+    size_t i;
+
+    if (ping_htab_init(t, cap) < 0) {
+        *t = old;
+        return -1;
+    }
+
+    for (i = 0; i < old.cap; i++) {
+        if (old.ent[i].val != NULL && old.ent[i].val != PING_HTAB_DELETED) {
+            ping_htab_put(t, old.ent[i].key, old.ent[i].val);
+        }
+    }
+
+    free(old.ent);
+
+    return 0;
+}
+
+int ping_htab_init(ping_htab *t, size_t cap)
+{
+    size_t c = PING_HTAB_MIN_CAP;
+
+    while (c < cap) {
+        c <<= 1;
+    }
+
+    t->ent = calloc(c, sizeof(ping_htab_entry));
+    if (t->ent == NULL) {
+        return -1;
+    }
+    t->cap = c;
+    t->len = 0;
+    t->used = 0;
+
+    return 0;
+}
+
+void ping_htab_free(ping_htab *t)
+{
+    free(t->ent);
+    t->ent = NULL;
+    t->cap = t->len = t->used = 0;
+}
+
+void *ping_htab_get(ping_htab *t, uint32_t key)
+{
+    ping_htab_entry *e = ping_htab_find(t, key);
+
+    return (e->val == PING_HTAB_DELETED) ? NULL : e->val;
+}
+
+/* Inserts or replaces the value of key, val must not be NULL */
+int ping_htab_put(ping_htab *t, uint32_t key, void *val)
+{
+    ping_htab_entry *e;
+
+    if (val == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Keep the load, removed entries included, under 3/4 */
+    if ((t->used + 1) * 4 > t->cap * 3) {
+        if (ping_htab_resize(t, (t->len + 1) * 2) < 0) {
+            return -1;
+        }
+    }
+
+    e = ping_htab_find(t, key);
+    if (e->val == NULL) {
+        t->used++;
+    }
+    if (e->val == NULL || e->val == PING_HTAB_DELETED) {
+        t->len++;
+    }
+    e->key = key;
+    e->val = val;
+
+    return 0;
+}
+
+/* Removes key, returning its value or NULL if it was not present */
+void *ping_htab_del(ping_htab *t, uint32_t key)
+{
+    ping_htab_entry *e = ping_htab_find(t, key);
+    void *val = e->val;
+
+    if (val == NULL || val == PING_HTAB_DELETED) {
+        return NULL;
+    }
+
+    e->val = PING_HTAB_DELETED;
+    t->len--;
+
+    return val;
+}
+
+/* Iterates the values, starting with *it = 0. Removing the current value
+ * while iterating is allowed. Returns NULL at the end. */
+void *ping_htab_next(ping_htab *t, size_t *it)
+{
+    for (; *it < t->cap; (*it)++) {
+        void *val = t->ent[*it].val;
+
+        if (val != NULL && val != PING_HTAB_DELETED) {
+            (*it)++;
+            return val;
+        }
+    }
+
+    return NULL;
+}
+
+/* FNV-1a, to key a table by name. Different names may get the same key, the
+ * owner compares the names on a hit. */
+uint32_t ping_htab_hash_str(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *s != '\0'; s++) {
+        h = (h ^ (uint8_t)*s) * 16777619u;
+    }
+
+    return h;
+}
@@ -0,0 +1,30 @@
+#ifndef PING_HTAB_H
+#define PING_HTAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PING_HTAB_MIN_CAP	16
+
+typedef struct ping_htab_entry_s {
+    uint32_t key;
+    void    *val;               /* NULL if free, PING_HTAB_DELETED if removed */
+} ping_htab_entry;
+
+/* Open addressing hash table with linear probing, keyed by IPv4 address or
+ * by the hash of a name. The capacity is always a power of 2. */
+typedef struct ping_htab_s {
+    ping_htab_entry *ent;
+    size_t           cap;
+    size_t           len;       /* live entries */
+    size_t           used;      /* live and removed entries */
+} ping_htab;
+
+int ping_htab_init(ping_htab *t, size_t cap);
+void ping_htab_free(ping_htab *t);
+void *ping_htab_get(ping_htab *t, uint32_t key);
+int ping_htab_put(ping_htab *t, uint32_t key, void *val);
+void *ping_htab_del(ping_htab *t, uint32_t key);
+void *ping_htab_next(ping_htab *t, size_t *it);
+uint32_t ping_htab_hash_str(const char *s);
+#endif
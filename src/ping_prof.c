@@ -0,0 +1,41 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ping_prof.h"
+
+ping_prof ping_prof_counters;
+
+static const char *ping_prof_names[PING_PROF_MAX] = {
+    [PING_PROF_POLL]     = "poll",
+    [PING_PROF_SEND]     = "send",
+    [PING_PROF_RECV]     = "recv",
+    [PING_PROF_CHECKSUM] = "checksum",
+    [PING_PROF_PRINT]    = "print",
+};
+
+void ping_prof_print(FILE *out)
+{
+    ping_prof *c = &ping_prof_counters;
+    int i;
+
+    fflush (stdout);
+    fprintf (out, "--- ft_ping self statistics ---\n");
+    fprintf (out, "syscalls: %" PRIu64 " send, %" PRIu64 " recv, %" PRIu64 " poll"
+             " (%" PRIu64 " EAGAIN, %" PRIu64 " EINTR)\n",
+             c->sys_send, c->sys_recv, c->sys_poll, c->eagain, c->eintr);
+    fprintf (out, "bytes: %" PRIu64 " sent, %" PRIu64 " received\n",
+             c->bytes_sent, c->bytes_recv);
+
+#if defined(__x86_64__) || defined(__i386__)
+    fprintf (out, "%-10s %12s %16s %12s\n", "stage", "calls", "cycles", "cycles/call");
+#else
+    fprintf (out, "%-10s %12s %16s %12s\n", "stage", "calls", "ns", "ns/call");
+#endif
+    for (i = 0; i < PING_PROF_MAX; i++) {
+        fprintf (out, "%-10s %12" PRIu64 " %16" PRIu64 " %12" PRIu64 "\n",
+                 ping_prof_names[i], c->calls[i], c->cycles[i],
+                 c->calls[i] ? c->cycles[i] / c->calls[i] : 0);
+    }
+}
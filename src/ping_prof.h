@@ -0,0 +1,67 @@
+#ifndef PING_PROF_H
+#define PING_PROF_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef PING_USDT
+#include <sys/sdt.h>
+#define PING_PROBE1(name, a)		DTRACE_PROBE1(ft_ping, name, a)
+#define PING_PROBE2(name, a, b)		DTRACE_PROBE2(ft_ping, name, a, b)
+#else
+#define PING_PROBE1(name, a)		do {} while (0)
+#define PING_PROBE2(name, a, b)		do {} while (0)
+#endif
+
+/* Stages of the hot path. They nest: send and recv include the checksum
+ * and print time of the packets they handle. */
+typedef enum ping_prof_stage_e {
+    PING_PROF_POLL,
+    PING_PROF_SEND,
+    PING_PROF_RECV,
+    PING_PROF_CHECKSUM,
+    PING_PROF_PRINT,
+    PING_PROF_MAX,
+} ping_prof_stage;
+
+typedef struct ping_prof_s {
+    uint64_t cycles[PING_PROF_MAX];
+    uint64_t calls[PING_PROF_MAX];
+    uint64_t sys_send;
+    uint64_t sys_recv;
+    uint64_t sys_poll;
+    uint64_t eagain;
+    uint64_t eintr;
+    uint64_t bytes_sent;
+    uint64_t bytes_recv;
+} ping_prof;
+
+extern ping_prof ping_prof_counters;
+
+/* Time stamp counter when available, nanoseconds otherwise */
+static inline uint64_t ping_prof_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* Accounts the time since start to stage */
+static inline void ping_prof_add(ping_prof_stage stage, uint64_t start)
+{
+    ping_prof_counters.cycles[stage] += ping_prof_now() - start;
+    ping_prof_counters.calls[stage]++;
+}
+
+void ping_prof_print(FILE *out);
+#endif
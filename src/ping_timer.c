@@ -0,0 +1,191 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "ping_utils.h"
+#include "ping_timer.h"
+
+static uint64_t ping_tw_tick(ping_tw *tw, struct timespec now)
+{
+    struct timespec elapsed;
+
+    elapsed = timespec_normalise(timespec_substract(now, tw->base));
+
+    return (elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000) / PING_TW_TICK_MS;
+}
+
+static void ping_tw_unlink(ping_tw *tw, uint16_t i)
+{
+    ping_tw_entry *e = &tw->ent[i];
+
+    if (e->prev != PING_TW_NONE) {
+        tw->ent[e->prev].next = e->next;
+    }
+    else {
+        tw->slot[e->expire & (tw->nslot - 1)] = e->next;
+    }
+
+    if (e->next != PING_TW_NONE) {
+        tw->ent[e->next].prev = e->prev;
+    }
+
+    e->active = false;
+    tw->active--;
+}
+
+/* Bytes of the arrays of a wheel with nent entries and nslot slots */
+size_t ping_tw_size(uint16_t nent, uint16_t nslot)
+{
+    return nent * sizeof(ping_tw_entry) + nslot * sizeof(uint16_t);
+}
+
+/* Gives tw its arrays, mem must hold ping_tw_size() bytes aligned as a
+ * ping_tw_entry. nent and nslot must be powers of 2. */
+void ping_tw_setup(ping_tw *tw, void *mem, uint16_t nent, uint16_t nslot)
+{
+    tw->ent = mem;
+    tw->slot = (uint16_t *)(tw->ent + nent);
+    tw->nent = nent;
+    tw->nslot = nslot;
+}
+
+void ping_tw_init(ping_tw *tw, struct timespec now)
+{
+    memset(tw->ent, 0, tw->nent * sizeof(ping_tw_entry));
+    memset(tw->slot, 0xFF, tw->nslot * sizeof(uint16_t));
+    tw->base = now;
+    tw->cur = 0;
+    tw->active = 0;
+}
+
+/* Arms the timer of seq to expire timeout_ms from now. If the entry is still
+ * in use by an older sequence that wrapped around, it is expired first so
+ * it is not silently lost. */
+void ping_tw_arm(ping_tw *tw, uint16_t seq, struct timespec now, double timeout_ms,
+                 ping_tw_cb cb, void *arg)
+{
+    uint16_t i = seq & (tw->nent - 1);
+    ping_tw_entry *e = &tw->ent[i];
+    uint64_t expire;
+    uint16_t *head;
+
+    if (e->active) {
+        uint16_t old = e->seq;
+
+        ping_tw_unlink(tw, i);
+        if (cb != NULL) {
+            cb(old, arg);
+        }
+    }
+
+    /* Round up so the timer never fires before its deadline */
+    expire = ping_tw_tick(tw, now) + (uint64_t)(timeout_ms / PING_TW_TICK_MS) + 1;
+    if (expire < tw->cur) {
+        expire = tw->cur;
+    }
+
+    head = &tw->slot[expire & (tw->nslot - 1)];
+
+    e->expire = expire;
+    e->seq = seq;
+    e->prev = PING_TW_NONE;
+    e->next = *head;
+    e->active = true;
+    if (*head != PING_TW_NONE) {
+        tw->ent[*head].prev = i;
+    }
+    *head = i;
+    tw->active++;
+}
+
+/* Returns true if seq was outstanding */
+bool ping_tw_cancel(ping_tw *tw, uint16_t seq)
+{
+    uint16_t i = seq & (tw->nent - 1);
+
+    if (!tw->ent[i].active || tw->ent[i].seq != seq) {
+        return false;
+    }
+
+    ping_tw_unlink(tw, i);
+
+    return true;
+}
+
+/* Expires every entry whose tick is due, calling cb for each of them.
+ * Returns the number of expired entries. */
+size_t ping_tw_expire(ping_tw *tw, struct timespec now, ping_tw_cb cb, void *arg)
+{
+    uint64_t tick = ping_tw_tick(tw, now);
+    uint64_t end = tick;
+    uint64_t t;
+    size_t n = 0;
+
+    if (tick < tw->cur) {
+        return 0;
+    }
+
+    /* Visiting each slot once is enough to see every entry */
+    if (end - tw->cur >= tw->nslot) {
+        end = tw->cur + tw->nslot - 1;
+    }
+
+    for (t = tw->cur; t <= end && tw->active > 0; t++) {
+        uint16_t i = tw->slot[t & (tw->nslot - 1)];
+
+        while (i != PING_TW_NONE) {
+            ping_tw_entry *e = &tw->ent[i];
+            uint16_t next = e->next;
+
+            if (e->expire <= tick) {
+                ping_tw_unlink(tw, i);
+                if (cb != NULL) {
+                    cb(e->seq, arg);
+                }
+                n++;
+            }
+            i = next;
+        }
+    }
+
+    tw->cur = tick + 1;
+
+    return n;
+}
+
+/* Returns the milliseconds until the next expiration, or -1 if nothing is
+ * armed. When nothing expires within one revolution the entries are looked
+ * at directly, so small wheels do not wake up on every revolution. */
+int ping_tw_next(ping_tw *tw, struct timespec now)
+{
+    uint64_t tick;
+    uint64_t t;
+    uint64_t first = UINT64_MAX;
+    uint16_t i;
+
+    if (tw->active == 0) {
+        return -1;
+    }
+
+    tick = ping_tw_tick(tw, now);
+
+    for (t = tw->cur; t < tw->cur + tw->nslot; t++) {
+        i = tw->slot[t & (tw->nslot - 1)];
+
+        for (; i != PING_TW_NONE; i = tw->ent[i].next) {
+            if (tw->ent[i].expire == t) {
+                return (t > tick) ? (t - tick) * PING_TW_TICK_MS : 0;
+            }
+        }
+    }
+
+    for (i = 0; i < tw->nent; i++) {
+        if (tw->ent[i].active && tw->ent[i].expire < first) {
+            first = tw->ent[i].expire;
+        }
+    }
+
+    return (first > tick) ? (first - tick) * PING_TW_TICK_MS : 0;
+}
@@ -0,0 +1,49 @@
+#ifndef PING_TIMER_H
+#define PING_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* A full wheel covers a bit more than the longest timeout, 10 s, so the
+ * next expiration is always found in its slots */
+#define PING_TW_SLOTS		1024	/* Slots of a full wheel, one per tick */
+#define PING_TW_TICK_MS		10		/* Milliseconds per tick */
+#define PING_TW_ENTRIES		1024	/* In-flight sequences of a full wheel */
+#define PING_TW_NONE		0xFFFF	/* End of slot list */
+
+typedef struct ping_tw_entry_s {
+    uint64_t expire;            /* absolute tick of expiration */
+    uint16_t seq;
+    uint16_t next;
+    uint16_t prev;
+    bool     active;
+} ping_tw_entry;
+
+/* Hashed timer wheel keyed by sequence number. Entries are stored at
+ * seq % nent and linked into the slot of their expiration tick, entries
+ * further than one revolution away simply stay in the slot until their tick
+ * is reached. Both arrays are given by the owner, so a target that never has
+ * many requests in flight can keep a small wheel. */
+typedef struct ping_tw_s {
+    struct timespec base;       /* time of tick 0 */
+    uint64_t        cur;        /* next tick to be processed */
+    uint32_t        active;     /* number of outstanding entries */
+    uint16_t        nent;       /* entries, a power of 2 */
+    uint16_t        nslot;      /* slots, a power of 2 */
+    uint16_t       *slot;
+    ping_tw_entry  *ent;
+} ping_tw;
+
+typedef void (*ping_tw_cb)(uint16_t seq, void *arg);
+
+size_t ping_tw_size(uint16_t nent, uint16_t nslot);
+void ping_tw_setup(ping_tw *tw, void *mem, uint16_t nent, uint16_t nslot);
+void ping_tw_init(ping_tw *tw, struct timespec now);
+void ping_tw_arm(ping_tw *tw, uint16_t seq, struct timespec now, double timeout_ms,
+                 ping_tw_cb cb, void *arg);
+bool ping_tw_cancel(ping_tw *tw, uint16_t seq);
+size_t ping_tw_expire(ping_tw *tw, struct timespec now, ping_tw_cb cb, void *arg);
+int ping_tw_next(ping_tw *tw, struct timespec now);
+#endif
@@ -1,4 +1,6 @@
+#include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/ip_icmp.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,6 +13,8 @@
 #include "ping_utils.h"
 
 #define PING_NSEC_PER_SEC 1000000000
+#define PING_SEC_PER_DAY  86400
+#define PING_MS_PER_DAY   (PING_SEC_PER_DAY * 1000)
 
 host *ping_get_host(char *hostname)
 {
@@ -129,6 +133,34 @@ uint16_t ping_calc_icmp_checksum(uint16_t *pkt, size_t len)
     return ~sum;
 }
 
+/* Adds the 16-bit words of buf to the running one's complement sum, so the
+ * checksum of a packet can be built from parts computed at different times.
+ * len must be even unless it is the last part. */
+uint32_t ping_csum_partial(const void *buf, size_t len, uint32_t sum)
+{
+    const uint16_t *p = buf;
+
+    for (; len > 1; p++, len -= 2) {
+        sum += *p;
+    }
+
+    if (len == 1) {
+        sum += *(const uint8_t *)p;
+    }
+
+    /* Keep room for further additions */
+    return (sum >> 16) + (sum & 0xffff);
+}
+
+/* Turns a running sum into the checksum to be written in the header */
+uint16_t ping_csum_fold(uint32_t sum)
+{
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+
+    return ~sum;
+}
+
 double timespec_to_ms(struct timespec ts)
 {
     return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
@@ -142,6 +174,14 @@ struct timespec ms_to_timespec(int ms)
     };
 }
 
+struct timespec ns_to_timespec(uint64_t ns)
+{
+    return (struct timespec) {
+        .tv_sec  = (ns / PING_NSEC_PER_SEC),
+        .tv_nsec = (ns % PING_NSEC_PER_SEC),
+    };
+}
+
 struct timespec timespec_substract(struct timespec last, struct timespec now)
 {
     return (struct timespec) {
@@ -178,6 +218,124 @@ struct timespec timespec_normalise(struct timespec ts)
     return ts;
 }
 
+/* RFC 792: Timestamps are milliseconds since midnight UT */
+uint32_t ms_since_midnight(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (now.tv_sec % PING_SEC_PER_DAY) * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Returns a - b for two times of the day, taking the wrap at midnight into
+ * account by choosing the shortest distance */
+int32_t ms_of_day_diff(uint32_t a, uint32_t b)
+{
+    int64_t d = (int64_t)a - b;
+
+    if (d > PING_MS_PER_DAY / 2) {
+        d -= PING_MS_PER_DAY;
+    }
+    else if (d < -PING_MS_PER_DAY / 2) {
+        d += PING_MS_PER_DAY;
+    }
+
+    return d;
+}
+
+/* Descriptions of the ICMP errors a request can get back (RFC 792), the
+ * ones of inetutils */
+static const struct {
+    int type;
+    int code;
+    const char *diag;
+} icmp_code_descr[] = {
+    { ICMP_DEST_UNREACH, ICMP_NET_UNREACH, "Destination Net Unreachable" },
+    { ICMP_DEST_UNREACH, ICMP_HOST_UNREACH, "Destination Host Unreachable" },
+    { ICMP_DEST_UNREACH, ICMP_PROT_UNREACH, "Destination Protocol Unreachable" },
+    { ICMP_DEST_UNREACH, ICMP_PORT_UNREACH, "Destination Port Unreachable" },
+    { ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, "Fragmentation needed and DF set" },
+    { ICMP_DEST_UNREACH, ICMP_SR_FAILED, "Source Route Failed" },
+    { ICMP_DEST_UNREACH, ICMP_NET_UNKNOWN, "Network Unknown" },
+    { ICMP_DEST_UNREACH, ICMP_HOST_UNKNOWN, "Host Unknown" },
+    { ICMP_DEST_UNREACH, ICMP_HOST_ISOLATED, "Host Isolated" },
+    { ICMP_DEST_UNREACH, ICMP_NET_UNR_TOS, "Destination Network Unreachable At This TOS" },
+    { ICMP_DEST_UNREACH, ICMP_HOST_UNR_TOS, "Destination Host Unreachable At This TOS" },
+    { ICMP_DEST_UNREACH, ICMP_PKT_FILTERED, "Packet Filtered" },
+    { ICMP_DEST_UNREACH, ICMP_PREC_VIOLATION, "Precedence Violation" },
+    { ICMP_DEST_UNREACH, ICMP_PREC_CUTOFF, "Precedence Cutoff" },
+    { ICMP_REDIRECT, ICMP_REDIR_NET, "Redirect Network" },
+    { ICMP_REDIRECT, ICMP_REDIR_HOST, "Redirect Host" },
+    { ICMP_REDIRECT, ICMP_REDIR_NETTOS, "Redirect Type of Service and Network" },
+    { ICMP_REDIRECT, ICMP_REDIR_HOSTTOS, "Redirect Type of Service and Host" },
+    { ICMP_TIME_EXCEEDED, ICMP_EXC_TTL, "Time to live exceeded" },
+    { ICMP_TIME_EXCEEDED, ICMP_EXC_FRAGTIME, "Frag reassembly time exceeded" },
+};
+
+/* Returns addr as inetutils prints the sender of an ICMP error, its name
+ * followed by the address when it resolves. The last answer is kept, errors
+ * tend to come from the same router. */
+const char *ping_addr_str(struct in_addr addr)
+{
+    static struct in_addr last;
+    static char str[NI_MAXHOST + INET_ADDRSTRLEN + 4];
+    struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr = addr };
+    char name[NI_MAXHOST];
+
+    if (str[0] != '\0' && last.s_addr == addr.s_addr) {
+        return str;
+    }
+    last = addr;
+    if (getnameinfo((struct sockaddr *)&sin, sizeof(sin), name, sizeof(name),
+                    NULL, 0, NI_NAMEREQD) == 0) {
+        snprintf(str, sizeof(str), "%s (%s)", name, inet_ntoa(addr));
+    }
+    else {
+        snprintf(str, sizeof(str), "%s", inet_ntoa(addr));
+    }
+    return str;
+}
+
+/* Prints the description of an ICMP error as inetutils does, gw being the
+ * second word of its header. The dump of the quoted IP header inetutils
+ * adds to some of them is left out. */
+void icmp_error_print(int type, int code, struct in_addr gw)
+{
+    const char *prefix;
+    size_t i;
+
+    switch (type) {
+    case ICMP_DEST_UNREACH:
+        prefix = "Dest Unreachable";
+        break;
+    case ICMP_REDIRECT:
+        prefix = "Redirect";
+        break;
+    case ICMP_TIME_EXCEEDED:
+        prefix = "Time exceeded";
+        break;
+    case ICMP_SOURCE_QUENCH:
+        printf ("Source Quench\n");
+        return;
+    case ICMP_PARAMETERPROB:
+        printf ("Parameter problem: IP address = %s\n", inet_ntoa (gw));
+        return;
+    default:
+        printf ("Bad ICMP type: %d\n", type);
+        return;
+    }
+
+    for (i = 0; i < sizeof(icmp_code_descr) / sizeof(icmp_code_descr[0]); i++) {
+        if (icmp_code_descr[i].type == type && icmp_code_descr[i].code == code) {
+            printf ("%s\n", icmp_code_descr[i].diag);
+            return;
+        }
+    }
+
+    printf ("%s, Unknown Code: %d\n", prefix, code);
+}
+
 double nabs (double a)
 {
     return (a < 0) ? -a : a;
@@ -249,3 +407,68 @@ void seq_clr(uint16_t seq, uint8_t *seq_map, size_t len)
 
     seq_map[i] &= ~mask;
 }
+
+char *ping_arena_strdup(ping_arena *a, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    ping_arena_chunk *c = a->head;
+    char *dst;
+
+    if (c == NULL || c->size - c->used < len) {
+        size_t size = (len > PING_ARENA_CHUNK) ? len : PING_ARENA_CHUNK;
+
+        c = malloc(sizeof(ping_arena_chunk) + size);
+        if (c == NULL) {
+            return NULL;
+        }
+        c->next = a->head;
+        c->used = 0;
+        c->size = size;
+        a->head = c;
+        a->size += sizeof(ping_arena_chunk) + size;
+    }
+
+    dst = c->data + c->used;
+    memcpy(dst, s, len);
+    c->used += len;
+    a->live += len;
+
+    return dst;
+}
+
+/* Only accounts s as unused, its memory stays until the arena is freed */
+void ping_arena_release(ping_arena *a, const char *s)
+{
+    a->live -= strlen(s) + 1;
+}
+
+/* Moves the strings of b to a, b is left empty. The strings of b are not
+ * accounted as live in a. */
+void ping_arena_join(ping_arena *a, ping_arena *b)
+{
+    ping_arena_chunk **tail = &a->head;
+
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = b->head;
+    a->size += b->size;
+
+    b->head = NULL;
+    b->size = b->live = 0;
+}
+
+void ping_arena_free(ping_arena *a)
+{
+    ping_arena_chunk *c = a->head;
+
+    while (c != NULL) {
+        ping_arena_chunk *next = c->next;
+
+        free(c);
+        c = next;
+    }
+
+    a->head = NULL;
+    a->size = a->live = 0;
+}
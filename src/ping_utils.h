@@ -8,19 +8,47 @@ typedef struct host_s {
     char *name;
 } host;
 
+#define PING_ARENA_CHUNK 4096
+
+typedef struct ping_arena_chunk_s {
+    struct ping_arena_chunk_s *next;
+    size_t used;
+    size_t size;
+    char   data[];
+} ping_arena_chunk;
+
+/* Bump allocator for short strings. They can not be freed one by one, the
+ * owner rebuilds the arena once released ones take too much of it. */
+typedef struct ping_arena_s {
+    ping_arena_chunk *head;
+    size_t size;                /* bytes allocated, headers included */
+    size_t live;                /* bytes of the strings not released */
+} ping_arena;
+
 host   *ping_get_host(char *hostname);
 int ping_decode_pattern(char  *optarg, uint8_t *pattern, int len);
 unsigned char *ping_generate_data(unsigned char * pat, int pat_len, unsigned char *data,
                                   size_t len);
 uint16_t ping_calc_icmp_checksum(uint16_t *pkt, size_t len);
+uint32_t ping_csum_partial(const void *buf, size_t len, uint32_t sum);
+uint16_t ping_csum_fold(uint32_t sum);
 double timespec_to_ms(struct timespec ts);
 struct timespec ms_to_timespec(int ms);
+struct timespec ns_to_timespec(uint64_t ns);
 struct timespec timespec_substract(struct timespec last, struct timespec now);
 struct timespec timespec_add(struct timespec last, struct timespec now);
 struct timespec timespec_normalise(struct timespec ts);
+uint32_t ms_since_midnight(void);
+int32_t ms_of_day_diff(uint32_t a, uint32_t b);
+const char *ping_addr_str(struct in_addr addr);
+void icmp_error_print(int type, int code, struct in_addr gw);
 double nabs (double a);
 double nsqrt (double a, double prec);
 bool seq_check(uint16_t seq, uint8_t *seq_map, size_t len);
 void seq_set(uint16_t seq, uint8_t *seq_map, size_t len);
 void seq_clr(uint16_t seq, uint8_t *seq_map, size_t len);
+char *ping_arena_strdup(ping_arena *a, const char *s);
+void ping_arena_release(ping_arena *a, const char *s);
+void ping_arena_join(ping_arena *a, ping_arena *b);
+void ping_arena_free(ping_arena *a);
 #endif
@@ -0,0 +1,37 @@
+import socket
+
+class PingControl:
+    """Client of the control socket of ft_ping --daemon"""
+
+    def __init__(self) -> None:
+        self.idle: list[socket.socket] = []
+
+    def send_control_command(self, path: str, command: str, timeout: float = 5) -> str:
+        """Sends one command and returns the whole reply, failing if it does
+        not come within timeout seconds."""
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+            sock.settimeout(float(timeout))
+            sock.connect(path)
+            sock.sendall(command.encode() + b"\n")
+
+            reply = b""
+            while True:
+                data = sock.recv(4096)
+                if not data:
+                    break
+                reply += data
+
+        print(reply.decode())
+        return reply.decode()
+
+    def open_idle_control_connections(self, path: str, count: int) -> None:
+        """Connects count clients which never send anything"""
+        for _ in range(int(count)):
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(path)
+            self.idle.append(sock)
+
+    def close_idle_control_connections(self) -> None:
+        for sock in self.idle:
+            sock.close()
+        self.idle = []
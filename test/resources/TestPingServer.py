@@ -10,6 +10,7 @@ from ping_utils import *
 ICMP_ECHO_REQUEST = 8
 ICMP_ECHO_REPLY = 0
 ICMP_UNREACHABLE = 3
+ICMP_TIME_EXCEEDED = 11
 MAX_ICMP_PACKET_SIZE = 1508  # includes IP + ICMP + payload
 
 class TestPingServer:
@@ -25,6 +26,7 @@ class TestPingServer:
                           icmp_type: int = ICMP_ECHO_REPLY,
                           wrong_checksum: bool = False,
                           wrong_id: bool = False,
+                          time_exceeded: bool = False,
                           comparable: bool = False) -> str:
         ret = ""
         while count:
@@ -39,6 +41,16 @@ class TestPingServer:
             ret += pretty_icmp_as_string(data[IP_HEADER_SIZE:], comparable, comparable)
             ret += "\n"
 
+            # Answer as a router would when the TTL runs out, quoting the
+            # request. Its IP header changes between runs, so it is not shown.
+            if time_exceeded:
+                packet = generate_error(ICMP_TIME_EXCEEDED, 0, data)
+                self.socket.sendto(packet, addr)
+                ret += f"=========================== SENT[{count}] ===========================\n"
+                ret += f"Time Exceeded quoting icmp_seq {req_seq}\n"
+                count -= 1
+                continue
+
             if payload != bytes():
                 req_payload = payload
 
@@ -59,5 +71,40 @@ class TestPingServer:
         print(ret)
         return ret
         
+    def start_responder(self) -> None:
+        """Answers every echo request in a background thread until
+        stop_responder() is called, used by the benchmark."""
+        self.start_test_server()
+        self.socket.settimeout(0.1)
+        self.responder_stats = {"requests": 0, "turnaround_ns": 0}
+        self.responder_running = True
+        self.responder = threading.Thread(target=self._respond, daemon=True)
+        self.responder.start()
+
+    def _respond(self) -> None:
+        stats = self.responder_stats
+        while self.responder_running:
+            try:
+                data, addr = self.socket.recvfrom(MAX_ICMP_PACKET_SIZE)
+            except socket.timeout:
+                continue
+            start = time.perf_counter_ns()
+
+            req_type, req_code, req_checksum, req_id, req_seq, req_payload = decode_icmp_data(data)
+            if req_type != ICMP_ECHO_REQUEST:
+                continue
+
+            packet = generate_message(ICMP_ECHO_REPLY, False, req_id, req_seq, req_payload)
+            self.socket.sendto(packet, addr)
+
+            stats["turnaround_ns"] += time.perf_counter_ns() - start
+            stats["requests"] += 1
+
+    def stop_responder(self) -> dict:
+        self.responder_running = False
+        self.responder.join()
+        self.stop_test_server()
+        return self.responder_stats
+
     def stop_test_server(self) -> None:
         self.socket.close()
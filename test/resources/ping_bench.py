@@ -0,0 +1,215 @@
+"""Loopback benchmark of ft_ping.
+
+Runs ft_ping against the TestPingServer responder and reports throughput,
+CPU per packet, RTT overhead added by the tool and memory as JSON, so runs
+of different commits can be compared.
+
+By default everything runs inside a fresh network namespace (requires root),
+where the kernel echo replies are disabled without touching the host. They
+are only enabled for the closed loop throughput run.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from TestPingServer import TestPingServer
+
+TEST_ADDRESS = "127.0.0.1"
+ECHO_IGNORE_SYSCTL = "/proc/sys/net/ipv4/icmp_echo_ignore_all"
+RTT_RE = re.compile(r"stddev = ([\d.]+)/([\d.]+)/([\d.]+)/([\d.]+) ms")
+STAT_RE = re.compile(r"(\d+) packets transmitted, (\d+) packets received")
+WINDOW = 64                 # requests in flight of the closed loop run
+
+
+def sample_hwm(pid: int, peak: list[int]) -> None:
+    """Samples the peak resident set size of pid until it exits. ru_maxrss is
+    not used since it also accounts the python process forked before exec."""
+    path = f"/proc/{pid}/status"
+    while True:
+        try:
+            with open(path) as f:
+                for line in f:
+                    if line.startswith("VmHWM:"):
+                        peak[0] = max(peak[0], int(line.split()[1]))
+                        break
+                else:
+                    return  # zombie, memory already released
+        except OSError:
+            return
+        time.sleep(0.01)
+
+
+def set_kernel_echo(enabled: bool) -> None:
+    with open(ECHO_IGNORE_SYSCTL, "w") as f:
+        f.write("0" if enabled else "1")
+
+
+def run_ping(ping: str, args: list[str], timeout: float,
+             kernel_echo: bool = False) -> dict:
+    """Runs ft_ping against the responder, or against the kernel echo
+    replies when kernel_echo is set, returning the resource usage of the
+    ft_ping process together with the statistics it reported."""
+    server = TestPingServer()
+    if kernel_echo:
+        set_kernel_echo(True)
+    else:
+        server.start_responder()
+
+    start = time.perf_counter()
+    proc = subprocess.Popen([ping] + args + [TEST_ADDRESS],
+                            stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    killer = threading.Timer(timeout, proc.kill)
+    killer.start()
+    peak = [0]
+    sampler = threading.Thread(target=sample_hwm, args=(proc.pid, peak))
+    sampler.start()
+    out = proc.stdout.read()
+    # Reap it ourselves to get the rusage of this child alone
+    sampler.join()
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.perf_counter() - start
+    killer.cancel()
+    proc.stdout.close()
+
+    if kernel_echo:
+        set_kernel_echo(False)
+        responder = {"requests": 0, "turnaround_ns": 0}
+    else:
+        responder = server.stop_responder()
+
+    result = {
+        "args": args,
+        "echo": "kernel" if kernel_echo else "responder",
+        "exit_status": os.waitstatus_to_exitcode(status),
+        "wall_s": wall,
+        "cpu_s": usage.ru_utime + usage.ru_stime,
+        "max_rss_kb": peak[0],
+        "responder_requests": responder["requests"],
+        "responder_turnaround_ms": (responder["turnaround_ns"] / responder["requests"] / 1e6
+                                    if responder["requests"] else None),
+    }
+
+    out = out.decode(errors="replace")
+    m = STAT_RE.search(out)
+    if m:
+        result["sent"] = int(m.group(1))
+        result["received"] = int(m.group(2))
+    m = RTT_RE.search(out)
+    if m:
+        result["rtt_min_ms"], result["rtt_avg_ms"], result["rtt_max_ms"], _ = \
+            (float(v) for v in m.groups())
+
+    return result
+
+
+def git_revision() -> str:
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], check=True,
+                              capture_output=True, text=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def pps(run: dict) -> float:
+    return run.get("received", 0) / run["wall_s"] if run["wall_s"] else 0
+
+
+def bench(ping: str, count: int, latency_count: int, kernel_echo: bool) -> dict:
+    # A plain flood only sends once the line is quiet for 10 ms, so it
+    # measures that rule. The capacity of the tool is measured closed loop,
+    # keeping WINDOW requests in flight, against the kernel replies when
+    # possible as the python responder would be the bottleneck. It is ten
+    # times as long, being that much faster.
+    flood = run_ping(ping, ["-f", f"-c{count}"], timeout=count)
+    window = run_ping(ping, ["-f", f"--window={WINDOW}", f"-c{count * 10}"], timeout=count,
+                      kernel_echo=kernel_echo)
+    latency = run_ping(ping, [f"-c{latency_count}", "-i0.2"], timeout=latency_count + 15)
+
+    report = {
+        "revision": git_revision(),
+        "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "flood": flood,
+        "window": window,
+        "latency": latency,
+    }
+
+    received = window.get("received", 0)
+    report["summary"] = {
+        "max_sustained_pps": pps(window),
+        "flood_pps": pps(flood),
+        "cpu_us_per_packet": (window["cpu_s"] / received * 1e6) if received else None,
+        # What is left of the RTT once the responder time is removed is the
+        # loopback plus the send/receive path of the tool
+        "rtt_overhead_ms": (latency["rtt_avg_ms"] - latency["responder_turnaround_ms"]
+                            if "rtt_avg_ms" in latency and latency["responder_turnaround_ms"]
+                            else None),
+        "max_rss_kb": max(flood["max_rss_kb"], window["max_rss_kb"], latency["max_rss_kb"]),
+    }
+
+    return report
+
+
+def compare(report: dict, baseline_path: str) -> None:
+    with open(baseline_path) as f:
+        baseline = json.load(f)
+
+    print(f"--- {baseline['revision']} -> {report['revision']} ---")
+    for key, value in report["summary"].items():
+        old = baseline.get("summary", {}).get(key)
+        if value is None or old is None:
+            print(f"{key:>20}: {old} -> {value}")
+            continue
+        delta = ((value - old) / old * 100) if old else 0
+        print(f"{key:>20}: {old:.3f} -> {value:.3f} ({delta:+.1f}%)")
+
+
+def enter_netns(argv: list[str]) -> None:
+    """Re-executes the benchmark inside a private network namespace"""
+    os.execvp("unshare", ["unshare", "--net", "--", sys.executable] + argv + ["--in-netns"])
+
+
+def setup_netns() -> None:
+    subprocess.run(["ip", "link", "set", "lo", "up"], check=True)
+    set_kernel_echo(False)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--ping", default="./ft_ping", help="binary under test")
+    parser.add_argument("--count", type=int, default=2000, help="flood packets")
+    parser.add_argument("--latency-count", type=int, default=20, help="timed packets")
+    parser.add_argument("--output", help="write the JSON report to this file")
+    parser.add_argument("--baseline", help="JSON report to compare against")
+    parser.add_argument("--no-netns", action="store_true",
+                        help="use the current namespace, kernel echo must be disabled")
+    parser.add_argument("--in-netns", action="store_true", help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if not args.no_netns and not args.in_netns:
+        enter_netns([os.path.abspath(__file__)] + sys.argv[1:])
+    if args.in_netns:
+        setup_netns()
+
+    # Outside of its own namespace the sysctl of the host is left alone
+    report = bench(os.path.abspath(args.ping), args.count, args.latency_count,
+                   kernel_echo=args.in_netns)
+
+    print(json.dumps(report, indent=2))
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+    if args.baseline:
+        compare(report, args.baseline)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
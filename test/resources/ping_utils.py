@@ -87,3 +87,10 @@ def generate_message(icmp_type: int, wrong_checksum: bool, icmp_id: int, icmp_se
 
     # Construct the final package
     return struct.pack("!BBHHH", resp_type, 0, checksum, resp_id, resp_seq) + resp_data
+
+def generate_error(icmp_type: int, icmp_code: int, datagram: bytes) -> bytes:
+    # Routers quote the offending datagram after the 4 unused bytes
+    packet = struct.pack("!BBHI", icmp_type, icmp_code, 0, 0) + datagram
+    checksum = calc_checksum(packet)
+
+    return struct.pack("!BBHI", icmp_type, icmp_code, checksum, 0) + datagram